@@ -36,6 +36,10 @@ AC_DEFUN([MPIRSHIM_CHECK_PMIX],[
                 [AC_HELP_STRING([--with-pmix-libdir=DIR],
                                 [Look for libpmix in the given directory DIR, DIR/lib or DIR/lib64])])
 
+    AC_ARG_ENABLE([pmix-dlopen],
+                  [AC_HELP_STRING([--enable-pmix-dlopen],
+                                  [Load libpmix at run time from where PMIx is found to be installed, instead of linking with it (default: disabled)])])
+
 
     if test "$with_pmix" = "no"; then
         AC_MSG_WARN([MPIRSHIM requires PMIx support using])
@@ -165,6 +169,19 @@ AC_DEFUN([MPIRSHIM_CHECK_PMIX],[
                 pmix_LDFLAGS=""])
         pmix_LIBS=-lpmix
 
+        # with --enable-pmix-dlopen, only link with what dlopen() needs
+        AC_MSG_CHECKING([whether to load libpmix at run time])
+        AS_IF([test "$enable_pmix_dlopen" = "yes"],
+              [AC_MSG_RESULT([yes])
+               AC_CHECK_LIB([dl], [dlopen],
+                            [pmix_LIBS=-ldl],
+                            [pmix_LIBS=""])
+               AC_DEFINE([MPIRSHIM_PMIX_DLOPEN], [1],
+                         [Whether to load libpmix at run time])
+               AC_DEFINE_UNQUOTED([MPIRSHIM_PMIX_LIBDIR], ["$pmix_ext_install_libdir"],
+                                  [Where configure found libpmix])],
+              [AC_MSG_RESULT([no])])
+
         AC_SUBST(pmix_CPPFLAGS)
         AC_SUBST(pmix_LDFLAGS)
         AC_SUBST(pmix_LIBS)
@@ -27,16 +27,20 @@
  * proxies all launch requests through the PMIx server.
  *
  * Unfortunately, if anything goes wrong, this wrapper program will
- * either hang or generate a fatal error.  If that happens, it tends
- * to leave the spawned processes around, which have to be cleaned up
- * manually.  The most common thing to go wrong is to try to launch a
+ * either stall or generate a fatal error.  A fatal error tends to
+ * leave the spawned processes around, which have to be cleaned up
+ * manually.  A stall is caught by the deadline of the launch phase it
+ * happens in, if one is set (see "--launch-timeout"), which kills the
+ * job.  The most common thing to go wrong is to try to launch a
  * non-PMIx application with a PMIx launcher.  For example, the
  * following is known to NOT work:
  *
  *   mpir prun -n 4 hostname
  *
- * The "hostname" processes will run away, and the mpir and prun
- * process will hang.
+ * The "hostname" processes run away without stopping in PMIx_Init().
+ * When the launcher reports that they terminated before we released
+ * them, mpir says so and kills the job.  Non-PMIx processes that keep
+ * running are only caught with "--pmix-grace", or by the deadline.
  */
 
 /*
@@ -101,6 +105,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <limits.h>
 #include <time.h>
@@ -109,17 +114,316 @@
 #include <errno.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/mman.h>
 #include <dirent.h>
 #include <signal.h>
+#include <poll.h>
+#include <fnmatch.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#if defined(HAVE_SYS_INOTIFY_H)
+#include <sys/inotify.h>
+#endif
+#if defined(HAVE_SYS_VFS_H)
+#include <sys/vfs.h>
+#endif
+
+#if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#define MAP_ANONYMOUS MAP_ANON
+#endif
 
 extern char **environ;
 
 #include <pmix_tool.h>
 
+#include <algorithm>
 #include <string>
-#include <set>
 #include <vector>
 
+/**********************************************************************/
+/* With "--enable-pmix-dlopen", libpmix isn't linked in.  It's loaded
+   by load_pmix_library() from pmix_prefix, so one executable can use
+   whichever PMIx is installed next to it, and the PMIx functions are
+   called through pmix_api.  The function types come from pmix.h, so
+   they match the PMIx we're compiled against.
+
+   The PMIx utility macros call into libpmix too, but which functions
+   they call depends on the version: pmix_value_load() and friends
+   before PMIx 4.2, PMIx_Info_load() and friends since, and more of
+   them (PMIx_Argv_append_nosize(), PMIx_Check_key(), ...) in later
+   releases.  So the macros we use are replaced by local code, which
+   only depends on the PMIx structures and calls the three value
+   functions through pmix_api, by whichever name the library has.  */
+
+#if defined(MPIRSHIM_PMIX_DLOPEN)
+#include <dlfcn.h>
+
+#define PMIX_API_FUNCTIONS(X)			\
+  X (PMIx_tool_init)				\
+  X (PMIx_tool_finalize)			\
+  X (PMIx_tool_connect_to_server)		\
+  X (PMIx_Get)					\
+  X (PMIx_Spawn)				\
+  X (PMIx_Query_info_nb)			\
+  X (PMIx_Register_event_handler)		\
+  X (PMIx_Notify_event)				\
+  X (PMIx_Job_control_nb)			\
+  X (PMIx_Error_string)				\
+  X (PMIx_Proc_state_string)			\
+  X (PMIx_Data_type_string)			\
+  X (PMIx_Get_version)
+
+struct pmix_api_t
+{
+#define PMIX_API_MEMBER(name_) __typeof__ (&name_) name_##_fn;
+  PMIX_API_FUNCTIONS (PMIX_API_MEMBER)
+#undef PMIX_API_MEMBER
+
+  /* PMIx_Value_load(), PMIx_Value_xfer() and PMIx_Value_destruct(),
+     or pmix_value_load() and so on before PMIx 4.2.  Declared here
+     because older headers don't declare all of them. */
+  void (*value_load_fn) (pmix_value_t *, const void *, pmix_data_type_t);
+  pmix_status_t (*value_xfer_fn) (pmix_value_t *, const pmix_value_t *);
+  void (*value_destruct_fn) (pmix_value_t *);	/* NULL if not exported */
+};
+static pmix_api_t pmix_api;
+
+/* Our signal handlers finalize PMIx, possibly before it's loaded. */
+static pmix_status_t
+pmix_api_tool_finalize()
+{
+  return (pmix_api.PMIx_tool_finalize_fn
+	  ? pmix_api.PMIx_tool_finalize_fn()
+	  : PMIX_ERR_INIT);
+}  /* pmix_api_tool_finalize */
+
+#define PMIx_tool_init			(*pmix_api.PMIx_tool_init_fn)
+#define PMIx_tool_finalize		pmix_api_tool_finalize
+#define PMIx_tool_connect_to_server	(*pmix_api.PMIx_tool_connect_to_server_fn)
+#define PMIx_Get			(*pmix_api.PMIx_Get_fn)
+#define PMIx_Spawn			(*pmix_api.PMIx_Spawn_fn)
+#define PMIx_Query_info_nb		(*pmix_api.PMIx_Query_info_nb_fn)
+#define PMIx_Register_event_handler	(*pmix_api.PMIx_Register_event_handler_fn)
+#define PMIx_Notify_event		(*pmix_api.PMIx_Notify_event_fn)
+#define PMIx_Job_control_nb		(*pmix_api.PMIx_Job_control_nb_fn)
+#define PMIx_Error_string		(*pmix_api.PMIx_Error_string_fn)
+#define PMIx_Proc_state_string		(*pmix_api.PMIx_Proc_state_string_fn)
+#define PMIx_Data_type_string		(*pmix_api.PMIx_Data_type_string_fn)
+#define PMIx_Get_version		(*pmix_api.PMIx_Get_version_fn)
+
+/* Release a value's data.  If the library doesn't export a function
+   for it (it's inline in some PMIx headers), free what we can and leak
+   the rest, rather than guess at the layout of nested data. */
+
+static void
+pmix_local_value_destruct (pmix_value_t *value_)
+{
+  if (pmix_api.value_destruct_fn)
+    pmix_api.value_destruct_fn (value_);
+  else if (PMIX_STRING == value_->type)
+    free (value_->data.string);
+  else if (PMIX_BYTE_OBJECT == value_->type)
+    free (value_->data.bo.bytes);
+  value_->type = PMIX_UNDEF;
+}  /* pmix_local_value_destruct */
+
+static void
+pmix_local_info_construct (pmix_info_t *info_)
+{
+  memset (info_, 0, sizeof (pmix_info_t));
+  info_->value.type = PMIX_UNDEF;
+}  /* pmix_local_info_construct */
+
+static pmix_info_t *
+pmix_local_info_create (size_t ninfo_)
+{
+  if (0 == ninfo_)
+    return NULL;
+  pmix_info_t *info = (pmix_info_t *) malloc (ninfo_ * sizeof (pmix_info_t));
+  if (NULL == info)
+    return NULL;
+  for (size_t n = 0; n < ninfo_; n++)
+    pmix_local_info_construct (&info[n]);
+#if defined(PMIX_INFO_ARRAY_END)
+  info[ninfo_ - 1].flags = PMIX_INFO_ARRAY_END;
+#endif
+  return info;
+}  /* pmix_local_info_create */
+
+static void
+pmix_local_info_destruct (pmix_info_t *info_)
+{
+#if defined(PMIX_INFO_PERSISTENT)
+  if (info_->flags & PMIX_INFO_PERSISTENT)
+    return;
+#endif
+  pmix_local_value_destruct (&info_->value);
+}  /* pmix_local_info_destruct */
+
+static void
+pmix_local_info_free (pmix_info_t *info_, size_t ninfo_)
+{
+  if (NULL == info_)
+    return;
+  for (size_t n = 0; n < ninfo_; n++)
+    pmix_local_info_destruct (&info_[n]);
+  free (info_);
+}  /* pmix_local_info_free */
+
+static void
+pmix_local_info_load (pmix_info_t *info_, const char *key_,
+		      const void *data_, pmix_data_type_t type_)
+{
+  pmix_local_info_construct (info_);
+  memcpy (info_->key, key_, strnlen (key_, PMIX_MAX_KEYLEN));
+  pmix_api.value_load_fn (&info_->value, data_, type_);
+}  /* pmix_local_info_load */
+
+static void
+pmix_local_info_xfer (pmix_info_t *dest_, const pmix_info_t *src_)
+{
+  pmix_local_info_construct (dest_);
+  memcpy (dest_->key, src_->key, sizeof (dest_->key));
+  dest_->flags = src_->flags;
+  (void) pmix_api.value_xfer_fn (&dest_->value, &src_->value);
+}  /* pmix_local_info_xfer */
+
+static void
+pmix_local_load_nspace (char *nspace_, const char *from_)
+{
+  memset (nspace_, 0, PMIX_MAX_NSLEN + 1);
+  if (NULL != from_)
+    memcpy (nspace_, from_, strnlen (from_, PMIX_MAX_NSLEN));
+}  /* pmix_local_load_nspace */
+
+static void
+pmix_local_argv_free (char **argv_)
+{
+  if (NULL == argv_)
+    return;
+  for (char **arg = argv_; *arg; arg++)
+    free (*arg);
+  free (argv_);
+}  /* pmix_local_argv_free */
+
+static pmix_status_t
+pmix_local_argv_append (char ***argv_, const char *arg_)
+{
+  size_t argc = 0;
+  while (*argv_ && (*argv_)[argc])
+    argc++;
+  char **argv = (char **) realloc (*argv_, (argc + 2) * sizeof (char *));
+  if (NULL == argv)
+    return PMIX_ERR_OUT_OF_RESOURCE;
+  *argv_ = argv;
+  argv[argc] = strdup (arg_);
+  argv[argc + 1] = NULL;
+  return (argv[argc] ? PMIX_SUCCESS : PMIX_ERR_OUT_OF_RESOURCE);
+}  /* pmix_local_argv_append */
+
+/* Set name_=value_ in env_, replacing any existing setting. */
+
+static pmix_status_t
+pmix_local_setenv (const char *name_, const char *value_, char ***env_)
+{
+  std::string setting (name_);
+  setting += '=';
+  if (value_)
+    setting += value_;
+  const size_t len = strlen (name_);
+  for (char **env = *env_; env && *env; env++)
+    if (0 == strncmp (*env, name_, len) && '=' == (*env)[len])
+      {
+	char *replacement = strdup (setting.c_str());
+	if (NULL == replacement)
+	  return PMIX_ERR_OUT_OF_RESOURCE;
+	free (*env);
+	*env = replacement;
+	return PMIX_SUCCESS;
+      }  /* if */
+  return pmix_local_argv_append (env_, setting.c_str());
+}  /* pmix_local_setenv */
+
+#undef PMIX_CHECK_KEY
+#define PMIX_CHECK_KEY(a, b)		(0 == strncmp ((a)->key, (b), PMIX_MAX_KEYLEN))
+#undef PMIX_LOAD_NSPACE
+#define PMIX_LOAD_NSPACE(a, b)		pmix_local_load_nspace ((a), (b))
+#undef PMIX_ARGV_APPEND
+#define PMIX_ARGV_APPEND(r, a, b)	((r) = pmix_local_argv_append (&(a), (b)))
+#undef PMIX_SETENV
+#define PMIX_SETENV(r, a, b, c)		((r) = pmix_local_setenv ((a), (b), (c)))
+#undef PMIX_VALUE_RELEASE
+#define PMIX_VALUE_RELEASE(m)		\
+  do { pmix_local_value_destruct (m); free (m); (m) = NULL; } while (0)
+#undef PMIX_INFO_CONSTRUCT
+#define PMIX_INFO_CONSTRUCT(m)		pmix_local_info_construct (m)
+#undef PMIX_INFO_CREATE
+#define PMIX_INFO_CREATE(m, n)		((m) = pmix_local_info_create (n))
+#undef PMIX_INFO_DESTRUCT
+#define PMIX_INFO_DESTRUCT(m)		pmix_local_info_destruct (m)
+#undef PMIX_INFO_LOAD
+#define PMIX_INFO_LOAD(m, k, v, t)	pmix_local_info_load ((m), (k), (v), (t))
+#undef PMIX_INFO_XFER
+#define PMIX_INFO_XFER(d, s)		pmix_local_info_xfer ((d), (s))
+#undef PMIX_PROC_CONSTRUCT
+#define PMIX_PROC_CONSTRUCT(m)		memset ((m), 0, sizeof (pmix_proc_t))
+#undef PMIX_PROC_DESTRUCT
+#define PMIX_PROC_DESTRUCT(m)
+#undef PMIX_PROC_LOAD
+#define PMIX_PROC_LOAD(m, n, r)		\
+  do { pmix_local_load_nspace ((m)->nspace, (n)); (m)->rank = (r); } while (0)
+#undef PMIX_QUERY_CONSTRUCT
+#define PMIX_QUERY_CONSTRUCT(m)		memset ((m), 0, sizeof (pmix_query_t))
+#undef PMIX_QUERY_DESTRUCT
+#define PMIX_QUERY_DESTRUCT(m)		\
+  do {					\
+    pmix_local_argv_free ((m)->keys);	\
+    (m)->keys = NULL;			\
+    pmix_local_info_free ((m)->qualifiers, (m)->nqual); \
+    (m)->qualifiers = NULL;		\
+    (m)->nqual = 0;			\
+  } while (0)
+#undef PMIX_APP_CONSTRUCT
+#define PMIX_APP_CONSTRUCT(m)		memset ((m), 0, sizeof (pmix_app_t))
+#undef PMIX_APP_DESTRUCT
+#define PMIX_APP_DESTRUCT(m)		\
+  do {					\
+    free ((m)->cmd);			\
+    (m)->cmd = NULL;			\
+    pmix_local_argv_free ((m)->argv);	\
+    (m)->argv = NULL;			\
+    pmix_local_argv_free ((m)->env);	\
+    (m)->env = NULL;			\
+    free ((m)->cwd);			\
+    (m)->cwd = NULL;			\
+    pmix_local_info_free ((m)->info, (m)->ninfo); \
+    (m)->info = NULL;			\
+    (m)->ninfo = 0;			\
+  } while (0)
+#undef PMIX_ENVAR_CONSTRUCT
+#define PMIX_ENVAR_CONSTRUCT(m)		memset ((m), 0, sizeof (pmix_envar_t))
+#undef PMIX_ENVAR_DESTRUCT
+#define PMIX_ENVAR_DESTRUCT(m)		\
+  do {					\
+    free ((m)->envar);			\
+    (m)->envar = NULL;			\
+    free ((m)->value);			\
+    (m)->value = NULL;			\
+  } while (0)
+#undef PMIX_ENVAR_LOAD
+#define PMIX_ENVAR_LOAD(m, e, v, s)	\
+  do {					\
+    PMIX_ENVAR_CONSTRUCT (m);		\
+    (m)->envar = (e) ? strdup (e) : NULL; \
+    (m)->value = (v) ? strdup (v) : NULL; \
+    (m)->separator = (s);		\
+  } while (0)
+#endif  /* MPIRSHIM_PMIX_DLOPEN */
+
 /**********************************************************************/
 /* Treat printf-style format type mismatches as errors */
 
@@ -273,15 +577,108 @@ int MPIR_partial_attach_ok;
  */
 int MPIR_ignore_queues;
 
+/*
+ * MPIR_debug_gate is an integer variable that is set to 1 by the tool
+ * to release the processes.  The MPIR specification puts it in each
+ * MPI process; here it is in the starter, and is only used with the
+ * "--debug-gate" option.  When the tool sets it to 1, every process
+ * that has not been released yet (see MPIR_shim_debug_gates) is
+ * released.
+ */
+VOLATILE int MPIR_debug_gate = 0;
+
 /*
  * Not implemented here:
+ *
+ * MPIR_acquired_pre_main would tell the tool that the processes were
+ * stopped before main().  They are stopped in PMIx_Init() (that is,
+ * in MPI_Init()) instead, so it is deliberately not defined.
  */
-// VOLATILE int MPIR_debug_gate;
 // int MPIR_acquired_pre_main;
 // char MPIR_executable_path[256];
 // char MPIR_server_arguments[1024];
 // char MPIR_attach_fifo[256];
 
+/**********************************************************************/
+/* MPIR shim extensions */
+/**********************************************************************/
+/*
+ * The following symbols are not part of the MPIR specification.  Tools
+ * that do not know about them can safely ignore them.
+ */
+
+/*
+ * When the proc table is packed (see "--proctable-layout"),
+ * MPIR_shim_proctable_region points to a single page-aligned region
+ * holding the MPIR_PROCDESC array followed by all of the host and
+ * executable name strings that the array points to, and
+ * MPIR_shim_proctable_region_size is the size of the region in bytes.
+ * A tool can read the entire table with a few large reads instead of
+ * chasing every string pointer.  Otherwise, both are 0.
+ */
+void *MPIR_shim_proctable_region = 0;
+size_t MPIR_shim_proctable_region_size = 0;
+
+/*
+ * MPIR_SHIM_HOSTDESC describes one block of MPIR_proctable: the
+ * num_procs entries starting at first_index, which all run on the
+ * host host_name.  host_name points to the same string as the
+ * entries' host_name.  node_id identifies the host, and is the same
+ * for every block on that host.
+ */
+typedef struct {
+  const char *host_name;
+  int first_index;
+  int num_procs;
+  int node_id;
+} MPIR_SHIM_HOSTDESC;
+
+/*
+ * MPIR_shim_hosttable points to an array of MPIR_shim_hosttable_size
+ * MPIR_SHIM_HOSTDESC structures, one for each run of consecutive
+ * MPIR_proctable entries on the same host, in MPIR_proctable order.
+ * With "--proctable-order=host" there is exactly one block per host.
+ * It is updated along with MPIR_proctable, so a tool can plan its
+ * attach per host without reading every process descriptor.
+ */
+MPIR_SHIM_HOSTDESC *MPIR_shim_hosttable = 0;
+int MPIR_shim_hosttable_size = 0;
+
+/*
+ * The following arrays are indexed like MPIR_proctable, and have
+ * MPIR_proctable_size elements each.  They are updated along with
+ * MPIR_proctable.  For entry i:
+ *   MPIR_shim_proctable_rank[i]       is its PMIx rank in its job,
+ *   MPIR_shim_proctable_node_id[i]    is the node_id of its host (see
+ *                                     MPIR_SHIM_HOSTDESC),
+ *   MPIR_shim_proctable_host_rank[i]  is its position among the procs
+ *                                     of its job on its host, in rank
+ *                                     order (which is PMIx's local rank
+ *                                     under the default ranking, but
+ *                                     isn't read from PMIx),
+ *   MPIR_shim_proctable_appnum[i]     is its application number,
+ *   MPIR_shim_proctable_state[i]      is its pmix_proc_state_t, and
+ *   MPIR_shim_proctable_exit_code[i]  is its exit code,
+ * all as of the last time the proc table was published.
+ */
+int *MPIR_shim_proctable_rank = 0;
+int *MPIR_shim_proctable_node_id = 0;
+int *MPIR_shim_proctable_host_rank = 0;
+int *MPIR_shim_proctable_appnum = 0;
+int *MPIR_shim_proctable_state = 0;
+int *MPIR_shim_proctable_exit_code = 0;
+
+/*
+ * With the "--debug-gate" option, MPIR_shim_debug_gates points to an
+ * array of MPIR_proctable_size chars, indexed like MPIR_proctable and
+ * initially 0.  The tool sets an element to 1 as soon as it is done
+ * with that process (for example, after setting its breakpoints), and
+ * the starter releases it, along with any others set at about the
+ * same time.  This lets the tool release processes while it is still
+ * attaching to others.  Otherwise, it is 0.
+ */
+VOLATILE char *MPIR_shim_debug_gates = 0;
+
 /**********************************************************************/
 /* Scoped pointer implementation, very similar to the Boost version.
  * Use this templated class to easily delete a pointer when a stack
@@ -348,6 +745,156 @@ template <typename T> class scoped_ptr
   T *p;
 };  /* scoped_ptr */
 
+/**********************************************************************/
+/* A string interning table.  Each unique string is copied once into a
+ * bump-allocated arena and is assigned a small integer id, in the
+ * order that the strings were first seen.  Lookups hash the caller's
+ * null-terminated string directly (FNV-1a) and probe an
+ * open-addressing table, so interning a string that is already in
+ * the table allocates no memory at all.
+ *
+ * Interned strings are never freed or moved until the table itself is
+ * destroyed, so the returned pointers can be stored in MPIR_proctable.
+ * The table is not thread safe; callers must provide any locking.
+ *
+ * Example:
+ *   string_table_t hosts;
+ *   uint32_t id;
+ *   const char *h1 = hosts.intern ("node01", &id);    // id == 0
+ *   const char *h2 = hosts.intern ("node01");         // h2 == h1
+ */
+
+class string_table_t
+{
+ public:
+  string_table_t()
+    : arena_block(0), arena_used(0), arena_size(0)
+    {
+      slots.assign (64, 0);
+    }  /* string_table_t */
+
+  ~string_table_t()
+    {
+      for (size_t i = 0; i < arena_blocks.size(); i++)
+	free (arena_blocks[i]);
+    }  /* ~string_table_t */
+
+  /* Return the shared copy of str_, adding it if it's not there yet.
+     If id_ is not null, the string's id is returned through it. */
+  const char *intern (const char *str_, uint32_t *id_ = 0)
+    {
+      if (!str_)
+	str_ = "";
+      uint32_t hash;
+      size_t len;
+      hash_string (str_, hash, len);
+      const size_t mask = slots.size() - 1;
+      size_t idx = hash & mask;
+      for (;;)
+	{
+	  const uint32_t slot = slots[idx];
+	  if (0 == slot)
+	    break;
+	  const uint32_t id = slot - 1;
+	  if (hashes[id] == hash &&
+	      lengths[id] == len &&
+	      0 == memcmp (strings[id], str_, len))
+	    {
+	      if (id_)
+		*id_ = id;
+	      return strings[id];
+	    }  /* if */
+	  idx = (idx + 1) & mask;
+	}  /* for */
+
+      /* Not found, so copy it into the arena and add it. */
+      const uint32_t id = strings.size();
+      char *copy = arena_alloc (len + 1);
+      memcpy (copy, str_, len + 1);
+      strings.push_back (copy);
+      hashes.push_back (hash);
+      lengths.push_back (len);
+      slots[idx] = id + 1;
+      if (strings.size() * 2 > slots.size())
+	rehash (slots.size() * 2);
+      if (id_)
+	*id_ = id;
+      return copy;
+    }  /* intern */
+
+  /* Number of unique strings in the table. */
+  size_t size() const		{ return strings.size(); }
+
+  /* The string and its length (not counting the null) for an id. */
+  const char *string (uint32_t id_) const	{ return strings[id_]; }
+  size_t length (uint32_t id_) const		{ return lengths[id_]; }
+
+ private:
+  /* Prevent copying */
+  string_table_t (const string_table_t &);
+  string_table_t &operator =(const string_table_t &);
+
+  /* Compute the FNV-1a hash and length of a string in a single pass. */
+  static void hash_string (const char *str_, uint32_t &hash_, size_t &len_)
+    {
+      uint32_t h = 2166136261u;
+      const unsigned char *p = (const unsigned char *) str_;
+      for (; *p; p++)
+	{
+	  h ^= *p;
+	  h *= 16777619u;
+	}  /* for */
+      hash_ = h;
+      len_ = (const char *) p - str_;
+    }  /* hash_string */
+
+  /* Grow the slot table, which must stay a power of 2. */
+  void rehash (size_t nslots_)
+    {
+      slots.assign (nslots_, 0);
+      const size_t mask = nslots_ - 1;
+      for (uint32_t id = 0; id < strings.size(); id++)
+	{
+	  size_t idx = hashes[id] & mask;
+	  while (0 != slots[idx])
+	    idx = (idx + 1) & mask;
+	  slots[idx] = id + 1;
+	}  /* for */
+    }  /* rehash */
+
+  /* Carve len_ bytes out of the current arena block, starting a new
+     block if it doesn't fit. */
+  char *arena_alloc (size_t len_)
+    {
+      if (arena_used + len_ > arena_size)
+	{
+	  arena_size = (len_ > arena_block_size ? len_ : arena_block_size);
+	  arena_block = (char *) malloc (arena_size);
+	  if (!arena_block)
+	    {
+	      fprintf (stderr, "string_table_t: out of memory\n");
+	      abort();
+	    }  /* if */
+	  arena_blocks.push_back (arena_block);
+	  arena_used = 0;
+	}  /* if */
+      char *p = arena_block + arena_used;
+      arena_used += len_;
+      return p;
+    }  /* arena_alloc */
+
+  static const size_t arena_block_size = 64 * 1024;
+
+  std::vector<uint32_t> slots;		/* id + 1 of each slot, 0 if empty */
+  std::vector<const char *> strings;	/* Indexed by id */
+  std::vector<uint32_t> hashes;		/* Indexed by id */
+  std::vector<size_t> lengths;		/* Indexed by id */
+  std::vector<char *> arena_blocks;
+  char *arena_block;
+  size_t arena_used;
+  size_t arena_size;
+};  /* string_table_t */
+
 /**********************************************************************/
 /* Forward references */
 
@@ -373,7 +920,7 @@ debug_printf (const char *format_ ...);
 static std::string
 get_errno_string (int errno_ = -1)
 {
-  if (-1 == errno)
+  if (-1 == errno_)
     errno_ = errno;
 
   char *errstr = (char *)strerror (errno_);
@@ -384,56 +931,111 @@ get_errno_string (int errno_ = -1)
 } /* get_errno_string */
 
 /**********************************************************************/
-/* Recursively delete the files and subdirectories in the given
- * directory, or as many files and subdirectories as possible.
+/* Recursively delete the directory name_ in the directory open as
+ * parent_fd_, and all of its contents, or as many files and
+ * directories as possible.  Everything is done relative to open
+ * directory file descriptors, so no paths are built except path_,
+ * which is only used in error messages.
  *
  * Returns an empty string on complete success, otherwise returns the
  * error string of the first failure encountered.
  */
 
 static std::string
-recursively_delete_directory (const char *dir_name_); /* Forward reference */
-
-static std::string
-recursively_delete_directory_contents (const char *dir_name_)
+delete_directory_at (int parent_fd_, const char *name_, const std::string &path_)
 {
-  DIR *dir = opendir (dir_name_);
+  std::string first_error;
+  int fd = openat (parent_fd_, name_, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+  DIR *dir = (fd >= 0 ? fdopendir (fd) : 0);
   if (!dir)
-    return (ENOENT != errno
-	    ? form_string ("opendir(\"%s\") failed: %s",
-			   dir_name_, get_errno_string().c_str())
-	    : 0);
+    {
+      if (ENOENT != errno)
+	first_error = form_string ("opendir(\"%s\") failed: %s",
+				   path_.c_str(), get_errno_string().c_str());
+      if (fd >= 0)
+	close (fd);
+      return first_error;
+    }  /* if */
+
   int err;
-  std::string first_error;
   struct dirent *entry;
   while ((entry = readdir (dir)))
     {
       if (!strcmp (entry->d_name, ".") ||
 	  !strcmp (entry->d_name, ".."))
 	continue;
-      const std::string path (std::string (dir_name_) + "/" + entry->d_name);
-      if (DT_DIR == entry->d_type)
+      bool is_dir = (DT_DIR == entry->d_type);
+      if (DT_UNKNOWN == entry->d_type)
 	{
-	  const std::string error (recursively_delete_directory (path.c_str()));
+	  struct stat st;
+	  is_dir = (0 == fstatat (fd, entry->d_name, &st, AT_SYMLINK_NOFOLLOW) &&
+		    S_ISDIR (st.st_mode));
+	}  /* if */
+      if (is_dir)
+	{
+	  const std::string error (delete_directory_at (fd, entry->d_name,
+							path_ + "/" + entry->d_name));
 	  if (first_error.empty() && !error.empty())
 	    first_error = error;
 	}  /* if */
       else
 	{
-	  while (-1 == (err = unlink (path.c_str())) && EINTR == errno);
-	  if (first_error.empty() && -1 == err)
-	    first_error = form_string ("unlink(\"%s\") failed: %s",
-				       path.c_str(), get_errno_string().c_str());
+	  while (-1 == (err = unlinkat (fd, entry->d_name, 0)) && EINTR == errno);
+	  if (first_error.empty() && -1 == err && ENOENT != errno)
+	    first_error = form_string ("unlink(\"%s/%s\") failed: %s",
+				       path_.c_str(), entry->d_name,
+				       get_errno_string().c_str());
 	}  /* else */
     }  /* while */
-  closedir (dir);
-  dir = 0;
+  closedir (dir);			/* Also closes fd */
+
+  while (-1 == (err = unlinkat (parent_fd_, name_, AT_REMOVEDIR)) && EINTR == errno);
+  if (first_error.empty() && -1 == err && ENOENT != errno)
+    first_error = form_string ("rmdir(\"%s\") failed: %s",
+			       path_.c_str(), get_errno_string().c_str());
   return first_error;
-}  /* recursively_delete_directory_contents */
+}  /* delete_directory_at */
+
+/* The top-level subdirectories of a directory being deleted, shared by
+   the threads deleting them. */
+
+struct delete_work_t
+{
+  pthread_mutex_t mutex;
+  int dir_fd;
+  const std::string *path;
+  std::vector<std::string> names;
+  size_t next;
+  std::string first_error;
+};  /* delete_work_t */
+
+static void *
+delete_directories_thread (void *arg_)
+{
+  delete_work_t *work = (delete_work_t *) arg_;
+  for (;;)
+    {
+      pthread_mutex_lock (&work->mutex);
+      const size_t n = work->next++;
+      pthread_mutex_unlock (&work->mutex);
+      if (n >= work->names.size())
+	break;
+      const std::string error (delete_directory_at (work->dir_fd, work->names[n].c_str(),
+						    *work->path + "/" + work->names[n]));
+      pthread_mutex_lock (&work->mutex);
+      if (work->first_error.empty() && !error.empty())
+	work->first_error = error;
+      pthread_mutex_unlock (&work->mutex);
+    }  /* for */
+  return 0;
+}  /* delete_directories_thread */
 
 /**********************************************************************/
 /* Recursively delete the directory and all of its contents, or as
- * many files and directories as possible.
+ * many files and directories as possible.  The files at the top level
+ * are deleted on this thread, and the subdirectories there (such as
+ * the per-job directories in a PMIx session directory) are deleted by
+ * several threads at once when there are enough of them.
  *
  * Returns an empty string on complete success, otherwise returns the
  * error string of the first failure encountered.
@@ -442,13 +1044,80 @@ recursively_delete_directory_contents (const char *dir_name_)
 static std::string
 recursively_delete_directory (const char *dir_name_)
 {
-  std::string first_error = recursively_delete_directory_contents (dir_name_);
+  const std::string path (dir_name_);
+  int fd = open (dir_name_, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+  DIR *dir = (fd >= 0 ? fdopendir (fd) : 0);
+  if (!dir)
+    {
+      std::string error;
+      if (ENOENT != errno)
+	error = form_string ("opendir(\"%s\") failed: %s",
+			     dir_name_, get_errno_string().c_str());
+      if (fd >= 0)
+	close (fd);
+      return error;
+    }  /* if */
+
+  /*
+   * Delete the files, and collect the subdirectories.
+   */
+  delete_work_t work;
+  pthread_mutex_init (&work.mutex, NULL);
+  work.dir_fd = fd;
+  work.path = &path;
+  work.next = 0;
   int err;
+  struct dirent *entry;
+  while ((entry = readdir (dir)))
+    {
+      if (!strcmp (entry->d_name, ".") ||
+	  !strcmp (entry->d_name, ".."))
+	continue;
+      bool is_dir = (DT_DIR == entry->d_type);
+      if (DT_UNKNOWN == entry->d_type)
+	{
+	  struct stat st;
+	  is_dir = (0 == fstatat (fd, entry->d_name, &st, AT_SYMLINK_NOFOLLOW) &&
+		    S_ISDIR (st.st_mode));
+	}  /* if */
+      if (is_dir)
+	work.names.push_back (entry->d_name);
+      else
+	{
+	  while (-1 == (err = unlinkat (fd, entry->d_name, 0)) && EINTR == errno);
+	  if (work.first_error.empty() && -1 == err && ENOENT != errno)
+	    work.first_error = form_string ("unlink(\"%s/%s\") failed: %s",
+					    dir_name_, entry->d_name,
+					    get_errno_string().c_str());
+	}  /* else */
+    }  /* while */
+
+  /*
+   * Delete the subdirectories, in parallel if there are several.
+   */
+  const size_t max_threads = 8;
+  size_t nthreads = std::min (work.names.size(), max_threads);
+  const long ncpus = sysconf (_SC_NPROCESSORS_ONLN);
+  if (ncpus > 0 && nthreads > size_t (ncpus))
+    nthreads = ncpus;
+  std::vector<pthread_t> threads;
+  for (size_t t = 1; t < nthreads; t++)
+    {
+      pthread_t thread;
+      if (0 == pthread_create (&thread, 0, delete_directories_thread, &work))
+	threads.push_back (thread);
+    }  /* for */
+  delete_directories_thread (&work);
+  for (size_t t = 0; t < threads.size(); t++)
+    pthread_join (threads[t], 0);
+  pthread_mutex_destroy (&work.mutex);
+  closedir (dir);			/* Also closes fd */
+
   while (-1 == (err = rmdir (dir_name_)) && EINTR == errno);
-  if (first_error.empty() && -1 == err && ENOENT != errno)
-    first_error = form_string ("rmdir(\"%s\") failed: %s",
-			       dir_name_, get_errno_string().c_str());
-  return first_error;
+  if (work.first_error.empty() && -1 == err && ENOENT != errno)
+    work.first_error = form_string ("rmdir(\"%s\") failed: %s",
+				    dir_name_, get_errno_string().c_str());
+  return work.first_error;
 }  /* recursively_delete_directory */
 
 /**********************************************************************/
@@ -535,50 +1204,96 @@ namespace pmix
 /* Our PMIx objects */
 /**********************************************************************/
 /*
- * A lock object for synchronizing the main and callback threads.
+ * A one-shot latch for synchronizing the main and callback threads.
+ * It starts closed, and once a callback opens it, it stays open.  The
+ * main thread can wait for it with a deadline, so that something the
+ * launcher, server or application never does can't hang us forever.
  */
 
-struct lock_t
+struct latch_t
 {
 
   pthread_mutex_t mutex;
   pthread_cond_t cond;
-  volatile bool active;
+  volatile bool closed;
   pmix::status_t status;
   int count;
 
-  lock_t()
+  latch_t()
     {
       pthread_mutex_init (&mutex, NULL);
       pthread_cond_init (&cond, NULL);
-      active = true;
+      closed = true;
       status = PMIX_SUCCESS;
       count = 0;
-    }  /* lock_t */
+    }  /* latch_t */
 
-  ~lock_t()
+  ~latch_t()
     {
       pthread_mutex_destroy (&mutex);
       pthread_cond_destroy (&cond);
-    }  /* ~lock_t */
+    }  /* ~latch_t */
 
+  /* Wait for the latch to open. */
   void wait_thread()
+    {
+      (void) wait_thread_until (0);
+    }  /* wait_thread */
+
+  /* Wait for the latch to open, until deadline_ (a get_seconds()
+     time, or 0 for no deadline).  Returns false if it didn't open. */
+  bool wait_thread_until (double deadline_)
     {
       pthread_mutex_lock (&mutex);
-      while (active)
-	pthread_cond_wait (&cond, &mutex);
+      while (closed && wait_cond (deadline_))
+	;
+      const bool opened = !closed;
       pthread_mutex_unlock (&mutex);
-    }  /* wait_thread */
+      return opened;
+    }  /* wait_thread_until */
+
+  /* With mutex locked, wait for cond to be signalled, until deadline_
+     (0 for no deadline).  Returns false if the deadline has passed. */
+  bool wait_cond (double deadline_)
+    {
+      if (0 == deadline_)
+	{
+	  pthread_cond_wait (&cond, &mutex);
+	  return true;
+	}  /* if */
+      struct timespec now;
+      clock_gettime (CLOCK_MONOTONIC, &now);
+      const double remaining = deadline_ - (now.tv_sec + now.tv_nsec * 1e-9);
+      if (remaining <= 0)
+	return false;
+				/* pthread_cond_timedwait() uses real time */
+      struct timespec abstime;
+      clock_gettime (CLOCK_REALTIME, &abstime);
+      const long long nsec = (abstime.tv_nsec +
+			      (long long) ((remaining - (time_t) remaining) * 1e9));
+      abstime.tv_sec += (time_t) remaining + nsec / 1000000000LL;
+      abstime.tv_nsec = nsec % 1000000000LL;
+      pthread_cond_timedwait (&cond, &mutex, &abstime);
+      return true;
+    }  /* wait_cond */
+
+  bool is_open()
+    {
+      pthread_mutex_lock (&mutex);
+      const bool opened = !closed;
+      pthread_mutex_unlock (&mutex);
+      return opened;
+    }  /* is_open */
 
   void wakeup_thread()
   {
     pthread_mutex_lock (&mutex);
-    active = false;
+    closed = false;
     pthread_cond_broadcast (&cond);
     pthread_mutex_unlock (&mutex);
   }  /* wakeup_thread */
 
-};  /* lock_t */
+};  /* latch_t */
 
 /**********************************************************************/
 /*
@@ -588,21 +1303,32 @@ struct lock_t
 struct query_data_t
 {
 
-  lock_t lock;
+  latch_t latch;
   pmix::status_t status;
   pmix::info_t *info;
   size_t ninfo;
   pmix::app_t *apps;
   size_t napps;
 
+  /* If process_fn is set, the query callback hands it the returned
+     info while the PMIx library still owns it, instead of copying the
+     info into this object.  It returns an empty string on success,
+     otherwise an error message for the main thread to report. */
+  std::string (*process_fn) (query_data_t *query_data_,
+			     const pmix_info_t info_[], size_t ninfo_);
+  void *process_data;			/* For process_fn's use */
+  std::string process_error;
+
   query_data_t()
-    : lock()
+    : latch()
     {
       status = PMIX_SUCCESS;
       info = 0;
       ninfo = 0;
       apps = 0;
       napps = 0;
+      process_fn = 0;
+      process_data = 0;
     }  /* query_data_t */
 
   ~query_data_t()
@@ -625,13 +1351,13 @@ struct query_data_t
 struct release_t
 {
 
-  lock_t lock;
+  latch_t latch;
   const char *nspace;
   int exit_code;
   bool exit_code_given;
 
   release_t()
-    : lock()
+    : latch()
     {
       nspace = 0;
       exit_code = 0;
@@ -648,45 +1374,296 @@ struct release_t
 
 /**********************************************************************/
 /*
- * An object to make it easier to register events.
+ * An object for streaming proc table entries to the debugger as the
+ * application processes report in.  The event handlers add to it, and
+ * the main thread waits on it for something to do.  A shared server
+ * reports other jobs' processes too, and they report in before we
+ * know the application's namespace, so the events keep their
+ * namespace, and the main thread sorts them out.
+ */
+
+typedef std::pair<std::string, pmix::rank_t> ready_proc_t;
+
+struct stream_t
+{
+
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  std::string nspace;			/* Set once the launch completes */
+  std::vector<ready_proc_t> ready;	/* Ready procs not yet taken */
+  bool all_ready;			/* A job-wide ready event arrived */
+  bool launch_complete;			/* The launch-complete event arrived */
+
+  stream_t()
+    {
+      pthread_mutex_init (&mutex, NULL);
+      pthread_cond_init (&cond, NULL);
+      all_ready = false;
+      launch_complete = false;
+    }  /* stream_t */
+
+  ~stream_t()
+    {
+      pthread_mutex_destroy (&mutex);
+      pthread_cond_destroy (&cond);
+    }  /* ~stream_t */
+
+  /* Record that a rank (or all ranks) of nspace_ is ready. */
+  void add_ready (const char *nspace_, pmix::rank_t rank_)
+    {
+      pthread_mutex_lock (&mutex);
+      if (PMIX_RANK_WILDCARD == rank_)
+	all_ready = true;
+      ready.push_back (ready_proc_t (nspace_, rank_));
+      pthread_cond_broadcast (&cond);
+      pthread_mutex_unlock (&mutex);
+    }  /* add_ready */
+
+  /* Record that the launch is complete. */
+  void set_launch_complete (const char *nspace_)
+    {
+      pthread_mutex_lock (&mutex);
+      nspace = nspace_;
+      launch_complete = true;
+      pthread_cond_broadcast (&cond);
+      pthread_mutex_unlock (&mutex);
+    }  /* set_launch_complete */
+
+};  /* stream_t */
+
+/**********************************************************************/
+/*
+ * An object for tracking the child jobs that the application creates
+ * with MPI_Comm_spawn() (or PMIx_Spawn()).  The event handlers add
+ * every job they hear about to it as a candidate, with its parent if
+ * the event says, and the main thread waits on it for new candidates
+ * until the launcher terminates.  A shared server reports other
+ * users' jobs too, and the application's own job starts before we
+ * know its namespace, so the main thread only follows a candidate
+ * whose parent is the application or a child it already follows.
  */
 
-struct register_event_handler_t
+struct child_job_t
+{
+  std::string nspace;
+  std::string parent;			/* Parent namespace, "" if unknown */
+
+  child_job_t (const char *nspace_, const char *parent_)
+    : nspace (nspace_), parent (parent_ ? parent_ : "") {}
+};  /* child_job_t */
+
+struct child_jobs_t
 {
 
-  pmix::status_t lock_status;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  std::vector<std::string> known;	/* Every namespace seen so far */
+  std::vector<child_job_t> pending;	/* Candidates not yet checked */
+  std::vector<std::string> followed;	/* The application and its children */
+  bool done;				/* The launcher has terminated */
+
+  child_jobs_t()
+    {
+      pthread_mutex_init (&mutex, NULL);
+      pthread_cond_init (&cond, NULL);
+      done = false;
+    }  /* child_jobs_t */
+
+  ~child_jobs_t()
+    {
+      pthread_mutex_destroy (&mutex);
+      pthread_cond_destroy (&cond);
+    }  /* ~child_jobs_t */
+
+  /* Add a candidate child job, whose parent namespace is parent_ (NULL
+     if unknown), unless we've seen it before. */
+  void add (const char *nspace_, const char *parent_)
+    {
+      pthread_mutex_lock (&mutex);
+      if (!is_known (nspace_))
+	{
+	  known.push_back (nspace_);
+	  pending.push_back (child_job_t (nspace_, parent_));
+	  pthread_cond_broadcast (&cond);
+	}  /* if */
+      pthread_mutex_unlock (&mutex);
+    }  /* add */
+
+  /* Add a namespace that is not a child job (ours, the launcher's, the
+     application's), so it's never published as one, even if a
+     candidate for it is already pending.  If is_parent_, its children
+     are followed. */
+  void add_non_child (const char *nspace_, bool is_parent_ = false)
+    {
+      pthread_mutex_lock (&mutex);
+      if (!is_known (nspace_))
+	known.push_back (nspace_);
+      for (size_t n = 0; n < pending.size(); n++)
+	if (pending[n].nspace == nspace_)
+	  pending.erase (pending.begin() + n--);
+      if (is_parent_)
+	followed.push_back (nspace_);
+      pthread_mutex_unlock (&mutex);
+    }  /* add_non_child */
+
+  /* Follow a child job, if its parent is followed.  Only the main
+     thread calls this.  Returns true if it's followed. */
+  bool follow (const child_job_t &job_)
+    {
+      pthread_mutex_lock (&mutex);
+      const bool is_followed = (followed.end() != std::find (followed.begin(),
+							     followed.end(),
+							     job_.parent));
+      if (is_followed)
+	followed.push_back (job_.nspace);
+      pthread_mutex_unlock (&mutex);
+      return is_followed;
+    }  /* follow */
+
+  /* Record that the launcher has terminated. */
+  void set_done()
+    {
+      pthread_mutex_lock (&mutex);
+      done = true;
+      pthread_cond_broadcast (&cond);
+      pthread_mutex_unlock (&mutex);
+    }  /* set_done */
+
+ private:
+  /* With mutex locked, have we seen nspace_ before? */
+  bool is_known (const char *nspace_) const
+    {
+      return known.end() != std::find (known.begin(), known.end(),
+				       std::string (nspace_));
+    }  /* is_known */
+
+};  /* child_jobs_t */
 
-  register_event_handler_t() {}
-  ~register_event_handler_t() {}
+/**********************************************************************/
+/*
+ * An object for registering several event handlers at once.  Event
+ * handler registration is done asynchronously because it may involve
+ * the PMIx server registering with the host RM for external events.
+ * Each registration is started with start() without waiting for it,
+ * and wait() waits for all of them, so their round trips to the
+ * server overlap.  PMIx keeps pointers to the codes and info until
+ * each registration completes, so the batch owns them.  We don't keep
+ * the registration ids, because we never deregister the handlers;
+ * the PMIx server will do so when it sees us exit.
+ */
 
-  pmix::status_t register_event_handler (pmix::status_t codes_[], size_t ncodes_,
-					 pmix::info_t info_[], size_t ninfo_,
-					 pmix::notification_fn_t event_hdlr_,
-					 pmix::hdlr_reg_cbfunc_t cbfunc_)
+class event_handler_batch_t
+{
+ public:
+  struct registration_t
   {
-    lock_t lock;
-    pmix::status_t rv = PMIx_Register_event_handler (codes_, ncodes_,
-						     info_, ninfo_,
-						     event_hdlr_,
-						     cbfunc_, &lock);
-    if (PMIX_SUCCESS == rv)
-      {
-	lock.wait_thread();
-	lock_status = lock.status;
-      }	 /* if */
-    return rv;
-  }  /* register_event_handler */
-
-  pmix::status_t register_event_handler (pmix::notification_fn_t event_hdlr_,
-					 pmix::hdlr_reg_cbfunc_t cbfunc_)
+    std::string name;
+    std::vector<pmix::status_t> codes;
+    std::vector<pmix::info_t> info;
+    pmix::status_t status;
+  };  /* registration_t */
+
+  event_handler_batch_t() {}
+
+  ~event_handler_batch_t()
+    {
+      for (size_t n = 0; n < registrations.size(); n++)
+	delete registrations[n];
+    }  /* ~event_handler_batch_t */
+
+  /* Add a registration named name_ for all events, and return it so
+     the caller can add info before start()ing it. */
+  registration_t &add (const char *name_)
+    {
+      registration_t *r = new registration_t;
+      r->name = name_;
+      r->info.reserve (10);
+      r->status = PMIX_SUCCESS;
+      registrations.push_back (r);
+      return *r;
+    }  /* add */
+
+  /* Add a registration named name_ for the event code_. */
+  registration_t &add (const char *name_, pmix::status_t code_)
+    {
+      registration_t &r = add (name_);
+      r.codes.push_back (code_);
+      return r;
+    }  /* add */
+
+  /* Start registering event_hdlr_ for r_, without waiting. */
+  pmix::status_t start (registration_t &r_,
+			pmix::notification_fn_t event_hdlr_)
+    {
+      pthread_mutex_lock (&latch.mutex);
+      latch.count++;
+      r_.status = PMIX_ERR_TIMEOUT;	/* Until it completes */
+      pthread_mutex_unlock (&latch.mutex);
+      callback_data_t *cbdata = new callback_data_t;
+      cbdata->batch = this;
+      cbdata->registration = &r_;
+      pmix::status_t rv =
+	PMIx_Register_event_handler (r_.codes.empty() ? 0 : &r_.codes.front(),
+				     r_.codes.size(),
+				     r_.info.empty() ? 0 : &r_.info.front(),
+				     r_.info.size(),
+				     event_hdlr_,
+				     registered, cbdata);
+      if (PMIX_SUCCESS != rv)
+	{
+	  delete cbdata;
+	  pthread_mutex_lock (&latch.mutex);
+	  latch.count--;
+	  r_.status = rv;
+	  pthread_mutex_unlock (&latch.mutex);
+	}  /* if */
+      return rv;
+    }  /* start */
+
+  /* Wait for all of the started registrations to complete, until
+     deadline_ (0 for no deadline).  Returns the first one that failed
+     or is still in flight, or 0 if they all succeeded. */
+  const registration_t *wait (double deadline_ = 0)
+    {
+      pthread_mutex_lock (&latch.mutex);
+      while (latch.count > 0 && latch.wait_cond (deadline_))
+	;
+      const registration_t *failed = 0;
+      for (size_t n = 0; n < registrations.size() && !failed; n++)
+	if (PMIX_SUCCESS != registrations[n]->status)
+	  failed = registrations[n];
+      pthread_mutex_unlock (&latch.mutex);
+      return failed;
+    }  /* wait */
+
+ private:
+  struct callback_data_t
   {
-    return register_event_handler ((pmix::status_t*)0, size_t(0),
-				   (pmix::info_t*)0, size_t(0),
-				   event_hdlr_,
-				   cbfunc_);
-  }  /* register_event_handler */
+    event_handler_batch_t *batch;
+    registration_t *registration;
+  };  /* callback_data_t */
+
+  static void registered (pmix_status_t status_,
+			  size_t evhandler_ref_,
+			  void *cbdata_)
+    {
+      callback_data_t *cbdata = (callback_data_t *) cbdata_;
+      latch_t &latch = cbdata->batch->latch;
+      pthread_mutex_lock (&latch.mutex);
+      cbdata->registration->status = status_;
+      if (0 == --latch.count)
+	pthread_cond_broadcast (&latch.cond);
+      pthread_mutex_unlock (&latch.mutex);
+      delete cbdata;
+    }  /* registered */
+
+  /* Prevent copying */
+  event_handler_batch_t (const event_handler_batch_t &);
+  event_handler_batch_t &operator =(const event_handler_batch_t &);
 
-};  /* register_event_handler_t */
+  latch_t latch;			/* count is the number in flight */
+  std::vector<registration_t *> registrations;
+};  /* event_handler_batch_t */
 
 /**********************************************************************/
 /* PMIx to MPIR wrapper tool code */
@@ -696,23 +1673,105 @@ struct register_event_handler_t
 static const char whoami[] = "mpir";	/* The name we go by */
 static pmix::proc_t myproc;		/* Our (mpir's) PMIx process structure */
 static bool debug_output = false;	/* Generate debug output? */
+static bool timing_output = false;	/* Report the time of each phase? */
+static bool background_cleanup = false;	/* Delete the session directory after we exit? */
 static std::string session_dirname;
 static std::string rendezvous_filename;
 static std::string pmix_prefix;
+static bool use_prefix_cache = true;	/* Remember where PMIx was found */
+static std::string server_uri;		/* The server to use for a non-proxy run */
+
+/* Which environment variables a proxy run passes to the launcher. */
+enum env_transfer_t
+{
+  env_full,				/* All of them */
+  env_delta				/* Only the ones set, changed or unset since */
+};
+static env_transfer_t env_transfer = env_full;
+static std::vector<std::string> env_allow;	/* Patterns of changed names passed */
+static std::vector<std::string> env_deny;	/* Patterns of names never passed */
+static std::vector<std::string> startup_environ; /* environ when we started, sorted */
+static int keep_dvm_idle_timeout = 0;	/* Seconds an idle kept DVM lives, 0 if not kept */
+static int proctable_threads = 0;	/* Conversion threads, 0 means one per CPU */
+
+/* How MPIR_proctable and its strings are laid out in memory. */
+enum proctable_layout_t
+{
+  layout_heap,				/* Separately allocated */
+  layout_packed,			/* One page-aligned region */
+  layout_huge				/* Packed, backed by huge pages if possible */
+};
+static proctable_layout_t proctable_layout = layout_heap;
+
+/* The order of the entries in MPIR_proctable. */
+enum proctable_order_t
+{
+  order_rank,				/* By rank, if the ranks are dense */
+  order_host,				/* Grouped by host, by rank within a host */
+  order_pmix				/* As PMIx returned them */
+};
+static proctable_order_t proctable_order = order_rank;
+static bool proctable_query_per_node = false; /* One local proc table query per node? */
+static size_t proctable_stream_batch = 0; /* First streaming batch size, 0 if not streaming */
+static stream_t *proctable_stream = 0;	/* Set while streaming the proc table */
+static bool skip_if_not_debugged = false; /* No MPIR work without a tool? */
+static bool use_debug_gate = false;	/* Release procs through the gates? */
+static bool follow_spawns = false;	/* Add child jobs to the proc table? */
+static child_jobs_t *child_jobs = 0;	/* Set while following child jobs */
+
+/* Proc tables with fewer procs than this are always converted on the
+ * main thread, because starting threads would cost more than it saves. */
+static const size_t parallel_conversion_threshold = 16384;
+
+/**********************************************************************/
+/* If we created a session directory, delete it when we exit. */
 
-/**********************************************************************/
-/* If we created a session directory, delete it when we exit. */
-
 struct delete_session_directory_t
 {
   ~delete_session_directory_t()
     {
-      if (!session_dirname.empty())
+      if (session_dirname.empty())
+	return;
+
+      /*
+       * With "--background-cleanup", leave the deleting to a detached
+       * grandchild, so we can exit right away.  If we can't fork, do
+       * it ourselves.  We're multithreaded (PMIx has its threads), so
+       * after fork() the children may only make async-signal-safe
+       * calls: no malloc() or threads, so they exec "rm -rf" instead
+       * of calling recursively_delete_directory(), with everything it
+       * needs set up before the fork.
+       */
+      if (background_cleanup)
 	{
-	  debug_printf ("Deleting session directory '%s'\n",
-			session_dirname.c_str());
-	  recursively_delete_directory (session_dirname.c_str());
+	  char *const rm_argv[] = {
+	    (char *) "rm", (char *) "-rf", (char *) "--",
+	    (char *) session_dirname.c_str(), NULL
+	  };
+	  pid_t pid = fork();
+	  if (0 == pid)
+	    {
+	      setsid();
+	      if (0 == fork())
+		{
+		  execve ("/bin/rm", rm_argv, environ);
+		  execve ("/usr/bin/rm", rm_argv, environ);
+		  _exit (1);
+		}  /* if */
+	      _exit (0);
+	    }  /* if */
+	  if (pid > 0)
+	    {
+	      debug_printf ("Deleting session directory '%s' in the background\n",
+			    session_dirname.c_str());
+	      waitpid (pid, NULL, 0);
+	      return;
+	    }  /* if */
 	}  /* if */
+
+      debug_printf ("Deleting session directory '%s'\n",
+		    session_dirname.c_str());
+      recursively_delete_directory (session_dirname.c_str());
     }  /* ~delete_session_directory_t */
 } delete_session_directory;
 
@@ -728,7 +1787,8 @@ struct delete_session_directory_t
  *   scalability by allowing it to cache data from the starter process
  *   and avoid reading redundant character strings.
  */
-static std::set<std::string> mpir_executables, mpir_hostnames;
+static string_table_t mpir_executables, mpir_hostnames;
+static string_table_t mpir_nspaces;	/* Of the proc table entries */
 
 /**********************************************************************/
 /* Utilities */
@@ -862,6 +1922,88 @@ struct entry_exit_t
 
 #define NOTE_ENTRY_EXIT() entry_exit_t entry_exit (__func__, __FILE__, __LINE__)
 
+/**********************************************************************/
+/* Return the current monotonic time in seconds, for timing things. */
+
+static double
+get_seconds()
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}  /* get_seconds */
+
+/**********************************************************************/
+/* The start and end times of each phase of the launch, for
+ * "--timing".  Phases can overlap and can be recorded from any
+ * thread.  Times are reported relative to when we started. */
+
+class phase_times_t
+{
+ public:
+  phase_times_t() : origin (get_seconds()), reported (0)
+    {
+      pthread_mutex_init (&mutex, NULL);
+    }  /* phase_times_t */
+
+  ~phase_times_t()
+    {
+      pthread_mutex_destroy (&mutex);
+    }  /* ~phase_times_t */
+
+  void record (const char *name_, double start_, double end_)
+    {
+      pthread_mutex_lock (&mutex);
+      phase_t phase = { name_, start_ - origin, end_ - origin };
+      phases.push_back (phase);
+      pthread_mutex_unlock (&mutex);
+    }  /* record */
+
+  /* Print the phases recorded since the last report. */
+  void report()
+    {
+      if (!timing_output)
+	return;
+      pthread_mutex_lock (&mutex);
+      for (; reported < phases.size(); reported++)
+	fprintf (stderr,
+		 "%s: timing: %-30s start %9.3f ms, took %9.3f ms\n",
+		 whoami,
+		 phases[reported].name,
+		 phases[reported].start * 1e3,
+		 (phases[reported].end - phases[reported].start) * 1e3);
+      pthread_mutex_unlock (&mutex);
+    }  /* report */
+
+ private:
+  struct phase_t
+  {
+    const char *name;
+    double start;
+    double end;
+  };  /* phase_t */
+
+  pthread_mutex_t mutex;
+  const double origin;
+  std::vector<phase_t> phases;
+  size_t reported;
+};  /* phase_times_t */
+
+static phase_times_t phase_times;
+
+/* Record the time from its construction to its destruction as a phase. */
+
+class scoped_phase_t
+{
+ public:
+  scoped_phase_t (const char *name_) : name (name_), start (get_seconds()) {}
+  ~scoped_phase_t() { phase_times.record (name, start, get_seconds()); }
+
+ private:
+  const char *name;
+  const double start;
+};  /* scoped_phase_t */
+
 /**********************************************************************/
 /* Print a usage message and exit */
 
@@ -880,9 +2022,83 @@ usage (const std::string error_ = std::string())
 	   "OPTIONS:\n"
 	   "  -h | --help                   This message.\n"
 	   "  -d | --debug                  Enable debug messages.\n"
+	   "  --timing                      Report how long each phase of the launch\n"
+	   "                                takes.\n"
+	   "  --launch-timeout=SECS         Kill the job if any phase of the launch\n"
+	   "                                makes no progress for SECS seconds\n"
+	   "                                (default 0, never).  Waiting in a batch\n"
+	   "                                queue for nodes counts, so allow for it.\n"
+	   "  --phase-timeout=PHASE=SECS    The same for one PHASE: \"connect\",\n"
+	   "                                \"register\", \"ready\", \"launch\",\n"
+	   "                                \"proctable\" or \"running\" (default 0).\n"
+	   "  --pmix-grace=SECS             Kill the job if none of its processes\n"
+	   "                                has called PMIx_Init() SECS seconds after\n"
+	   "                                the launch completes (default 0, never).\n"
+	   "                                Needs a server that sends ready-for-debug\n"
+	   "                                events.\n"
 	   "  -p | --force-proxy-run        Force a proxy run.\n"
 	   "  -n | --force-non-proxy-run    Force a non-proxy run.\n"
+	   "  --env-transfer=MODE           Environment variables to pass to the\n"
+	   "                                launcher in a proxy run: \"full\" (default)\n"
+	   "                                for our current ones, or \"delta\" for only\n"
+	   "                                those set, changed or unset since we\n"
+	   "                                started, if PMIx merges them into the\n"
+	   "                                environment the launcher inherits (PMIx 4\n"
+	   "                                and later), and all of them otherwise.\n"
+	   "  --env-allow=PATTERNS          With \"delta\", only pass the variables set\n"
+	   "                                or changed since we started whose names\n"
+	   "                                match the comma-separated glob PATTERNS.\n"
+	   "  --env-deny=PATTERNS           Never pass the variables whose names match\n"
+	   "                                the comma-separated glob PATTERNS.\n"
+	   "  --background-cleanup          Delete the session directory in a detached\n"
+	   "                                process, so we can exit right away.\n"
 	   "  --pmix-prefix PATH            PATH where PMIx is installed.\n"
+	   "  --no-prefix-cache             Always search for where PMIx is installed,\n"
+	   "                                instead of using what an earlier run found.\n"
+	   "  --keep-dvm[=SECS]             Launch in a DVM that is kept running\n"
+	   "                                between runs, and shut down after it has\n"
+	   "                                been idle for SECS (default 600) seconds.\n"
+	   "                                LAUNCHER must be prun or prterun, and is\n"
+	   "                                replaced with prun.\n"
+	   "  --discover                    Look for a running PMIx server (the system\n"
+	   "                                server or a DVM) and do a non-proxy run\n"
+	   "                                with the first one that answers, or a proxy\n"
+	   "                                run if none does.\n"
+	   "  --server-uri=URI              Like \"--discover\", but also try the server\n"
+	   "                                at URI (or \"file:PATH\" to read it from a\n"
+	   "                                rendezvous file).\n"
+	   "  --proctable-threads N         Use N threads to convert large proc\n"
+	   "                                tables (default: one per CPU).\n"
+	   "  --proctable-layout=LAYOUT     Memory layout of MPIR_proctable: \"heap\"\n"
+	   "                                (default), \"packed\" into one page-aligned\n"
+	   "                                region, or \"huge\" to pack it into huge\n"
+	   "                                pages if possible.\n"
+	   "  --proctable-order=ORDER       Order of the MPIR_proctable entries: \"rank\"\n"
+	   "                                (default), \"host\" to group the procs on\n"
+	   "                                each host together, or \"pmix\" to keep the\n"
+	   "                                order PMIx returned them in.\n"
+	   "  --proctable-query=QUERY       How to query the proc table: \"global\"\n"
+	   "                                (default) with one query, or \"per-node\"\n"
+	   "                                with concurrent local queries per node,\n"
+	   "                                if the server answers them for any node.\n"
+	   "  --proctable-stream[=BATCH]    Stream proc table entries to the debugger\n"
+	   "                                as processes report in, in batches that\n"
+	   "                                start at BATCH (default 64) and double.\n"
+	   "  --follow-spawns               Add jobs that the application spawns (for\n"
+	   "                                example with MPI_Comm_spawn) to the proc\n"
+	   "                                table.\n"
+	   "  --skip-if-not-debugged        If MPIR_being_debugged is 0 at startup,\n"
+	   "                                don't stop the processes or build the\n"
+	   "                                proc table.\n"
+	   "  --debug-gate                  Release each process when the tool sets\n"
+	   "                                its entry in MPIR_shim_debug_gates, or all\n"
+	   "                                of them when it sets MPIR_debug_gate.\n"
+	   "  --attach-ranks=LIST           Only put the ranks in LIST, such as\n"
+	   "                                \"0-3,17\", in the proc table, and release\n"
+	   "                                the other ranks right away.\n"
+	   "  --attach-hosts=LIST           Only put the procs on the comma-separated\n"
+	   "                                hosts in LIST in the proc table, and release\n"
+	   "                                the other procs right away.\n"
 	   "\n"
 	   "LAUNCHER:\n"
 	   "  Name of a PMIx launcher, such as \"prun\" or \"mpirun\".\n"
@@ -899,12 +2115,34 @@ usage (const std::string error_ = std::string())
 	   "A \"proxy run\" assumes that there is no persistent PMIx DVM running and\n"
 	   "LAUNCHER will start a temporary DVM.  By default, if LAUNCHER is named\n"
 	   "\"prun\" then a non-proxy run is done, otherwise a proxy run is done.\n"
+	   "With \"--discover\", it depends on whether a server is running instead.\n"
 	   "\n"
 	   "Report bugs to /dev/null\n",
 	   whoami);
   exit (1);
 }  /* usage */
 
+/**********************************************************************/
+/* If argv_[i_] is the option name_, return its value and advance i_ to
+ * the last argument used.  The value can be given either as
+ * "name=VALUE" or as "name VALUE".  Returns 0 if argv_[i_] is some
+ * other option. */
+
+static const char *
+option_value (const char *name_, int &i_, int argc_, char **argv_)
+{
+  const size_t len = strlen (name_);
+  if (0 != strncmp (argv_[i_], name_, len))
+    return 0;
+  if ('=' == argv_[i_][len])
+    return argv_[i_] + len + 1;
+  if ('\0' != argv_[i_][len])
+    return 0;
+  if (i_ + 1 >= argc_)
+    usage (form_string ("Argument required for option \"%s\"", name_));
+  return argv_[++i_];
+}  /* option_value */
+
 /**********************************************************************/
 /* Macros to define pmix::info_t vectors, and append to them.  The
  * vector starts out with space reserved for 10 elements, but grows if
@@ -942,6 +2180,18 @@ info_next (std::vector<pmix::info_t> &vec_)
  * release_fn_ so that the PMIx library can cleanup.
  */
 
+/* Did a query with several keys get answers for only some of them? */
+
+static bool
+is_partial_success (pmix_status_t status_)
+{
+#if defined(PMIX_QUERY_PARTIAL_SUCCESS)
+  if (PMIX_QUERY_PARTIAL_SUCCESS == status_)
+    return true;
+#endif
+  return PMIX_ERR_PARTIAL_SUCCESS == status_;
+}  /* is_partial_success */
+
 static void
 query_callback_fn (pmix_status_t status_,
 		   pmix_info_t *info_, size_t ninfo_,
@@ -954,24 +2204,32 @@ query_callback_fn (pmix_status_t status_,
   query_data_t *mq = (query_data_t*) cbdata_;
   mq->status = status_;
 
+  for (size_t n = 0; n < ninfo_; n++)
+    {
+      debug_printf ("Key '%s' Type '%s' (%d)\n",
+		    info_[n].key,
+		    PMIx_Data_type_string(info_[n].value.type),
+		    info_[n].value.type);
+    }  /* for */
+
   /*
-   * Save the returned info - the PMIx library "owns" it and will
-   * release it and perform other cleanup actions when release_fn_()
-   * is called.
+   * Process or save the returned info - the PMIx library "owns" it
+   * and will release it and perform other cleanup actions when
+   * release_fn_() is called.  Processing it in place avoids making a
+   * copy of what can be a very large proc table.
    */
-  if (0 < ninfo_)
+  if (NULL != mq->process_fn)
+    {
+      if (PMIX_SUCCESS == status_ || is_partial_success (status_))
+	mq->process_error = mq->process_fn (mq, info_, ninfo_);
+    }  /* if */
+  else if (0 < ninfo_)
     {
       mq->info = new pmix::info_t[ninfo_];
       mq->ninfo = ninfo_;
       for (size_t n = 0; n < ninfo_; n++)
-	{
-	  debug_printf ("Key '%s' Type '%s' (%d)\n",
-			info_[n].key,
-			PMIx_Data_type_string(info_[n].value.type),
-			info_[n].value.type);
-	  PMIX_INFO_XFER (&mq->info[n], &info_[n]);
-	}  /* for */
-    }  /* if */
+	PMIX_INFO_XFER (&mq->info[n], &info_[n]);
+    }  /* else-if */
 
   /*
    * Let the library release the data and cleanup from the operation.
@@ -982,9 +2240,517 @@ query_callback_fn (pmix_status_t status_,
   /*
    * Release the lock
    */
-  mq->lock.wakeup_thread();
+  mq->latch.wakeup_thread();
 }  /* query_callback_fn */
 
+/**********************************************************************/
+/*
+ * An object for noticing early that the application doesn't use PMIx,
+ * so it can't be stopped in PMIx_Init() or debugged through us.  While
+ * the processes are held for the debugger, a PMIx application process
+ * can't terminate, and reports PMIX_READY_FOR_DEBUG once it stops.  So
+ * a process that terminates before we release it never called
+ * PMIx_Init(), and neither did a job none of whose processes report
+ * in within the "--pmix-grace" period after the launch completes.
+ * The event handlers fill it in, and the main thread checks it while
+ * it waits.  Only the application's events count, but the server
+ * reports other jobs' events too, and the application's can arrive
+ * before the launch completes and tells us its namespace, so until
+ * then the events are kept, and sorted out once we know.
+ */
+
+struct app_event_t
+{
+  std::string nspace;
+  pmix::rank_t rank;
+  bool ready;				/* Else terminated */
+  int exit_code;
+  pmix::status_t status;
+};  /* app_event_t */
+
+struct app_watch_t
+{
+
+  pthread_mutex_t mutex;
+  std::string app_nspace;		/* Set once the launch completes */
+  std::vector<app_event_t> early_events;	/* Until app_nspace is set */
+  size_t nready;			/* PMIX_READY_FOR_DEBUG events */
+  bool terminated;			/* An application process terminated */
+  std::string terminated_nspace;	/* The first one to */
+  pmix::rank_t terminated_rank;
+  int terminated_exit_code;
+  pmix::status_t terminated_status;
+
+  app_watch_t()
+    {
+      pthread_mutex_init (&mutex, NULL);
+      nready = 0;
+      terminated = false;
+      terminated_rank = PMIX_RANK_WILDCARD;
+      terminated_exit_code = 0;
+      terminated_status = PMIX_SUCCESS;
+    }  /* app_watch_t */
+
+  ~app_watch_t()
+    {
+      pthread_mutex_destroy (&mutex);
+    }  /* ~app_watch_t */
+
+  /* Record that process rank_ (or all processes) of nspace_ is
+     ready, or terminated. */
+  void add_event (const char *nspace_, pmix::rank_t rank_, bool ready_,
+		  int exit_code_ = 0, pmix::status_t status_ = PMIX_SUCCESS)
+    {
+      app_event_t event;
+      event.nspace = nspace_;
+      event.rank = rank_;
+      event.ready = ready_;
+      event.exit_code = exit_code_;
+      event.status = status_;
+      pthread_mutex_lock (&mutex);
+      if (app_nspace.empty())
+	early_events.push_back (event);
+      else
+	record (event);
+      pthread_mutex_unlock (&mutex);
+    }  /* add_event */
+
+  /* Set the application's namespace, and count its events so far. */
+  void set_app_nspace (const char *nspace_)
+    {
+      pthread_mutex_lock (&mutex);
+      app_nspace = nspace_;
+      for (size_t n = 0; n < early_events.size(); n++)
+	record (early_events[n]);
+      early_events.clear();
+      pthread_mutex_unlock (&mutex);
+    }  /* set_app_nspace */
+
+  /* If an application process terminated before any process became
+     ready, describe it in diagnostic_ and return true. */
+  bool terminated_early (std::string &diagnostic_)
+    {
+      pthread_mutex_lock (&mutex);
+      const bool early = terminated && 0 == nready;
+      if (early)
+	diagnostic_ =
+	  form_string ("%s of job '%s' terminated (%s, exit code %d) "
+		       "before calling PMIx_Init()",
+		       (PMIX_RANK_WILDCARD == terminated_rank
+			? std::string ("Every process")
+			: form_string ("Process %u", (unsigned int) terminated_rank)).c_str(),
+		       terminated_nspace.c_str(),
+		       PMIx_Error_string (terminated_status),
+		       terminated_exit_code);
+      pthread_mutex_unlock (&mutex);
+      return early;
+    }  /* terminated_early */
+
+  /* How many ready events have arrived. */
+  size_t get_nready()
+    {
+      pthread_mutex_lock (&mutex);
+      const size_t n = nready;
+      pthread_mutex_unlock (&mutex);
+      return n;
+    }  /* get_nready */
+
+ private:
+  /* With mutex locked, count event_ if it's the application's. */
+  void record (const app_event_t &event_)
+    {
+      if (app_nspace != event_.nspace)
+	return;
+      if (event_.ready)
+	nready++;
+      else if (!terminated)
+	{
+	  terminated = true;
+	  terminated_nspace = event_.nspace;
+	  terminated_rank = event_.rank;
+	  terminated_exit_code = event_.exit_code;
+	  terminated_status = event_.status;
+	}  /* else-if */
+    }  /* record */
+
+};  /* app_watch_t */
+
+static double pmix_grace = 0;		/* Seconds for the first process to be ready, 0 for no limit */
+
+/**********************************************************************/
+/* The launch is a sequence of phases, each of which waits for the
+ * launcher, the server or the application to do something.  Each
+ * phase has a deadline, and a phase that misses it has stalled: we say
+ * which one, and tear the job down rather than hang, holding its
+ * allocation, forever.  A timeout of 0 means no deadline.  Time spent
+ * stopped in MPIR_Breakpoint() doesn't count against a phase.
+ */
+
+enum launch_phase_t
+{
+  phase_startup,			/* Before waiting for anything */
+  phase_connect,			/* Connecting to the launcher */
+  phase_register,			/* Registering the event handlers */
+  phase_ready,				/* The launcher getting ready */
+  phase_launch,				/* The launcher launching the job */
+  phase_proctable,			/* Getting the proc table */
+  phase_running,			/* The job running */
+  num_launch_phases
+};
+
+static struct
+{
+  const char *name;			/* For "--phase-timeout" */
+  const char *waiting_for;		/* For the stall report */
+  double timeout;			/* Seconds */
+} launch_phases[num_launch_phases] =
+{
+  { "startup",   "nothing",					0 },
+  { "connect",   "the launcher's PMIx server",			0 },
+  { "register",  "the event handlers to be registered",		0 },
+  { "ready",     "the launcher to be ready",			0 },
+  { "launch",    "the launcher to launch the application",	0 },
+  { "proctable", "the proc table of the application",		0 },
+  { "running",   "the launcher to terminate",			0 }
+};
+
+class launch_state_t
+{
+ public:
+  launch_state_t()
+    : app_watch (0), launcher_pid (0), phase (phase_startup), entered (0),
+      deadline (0), launch_completed (0) {}
+
+  /* Move on to phase_. */
+  void enter (launch_phase_t phase_)
+    {
+      phase = phase_;
+      restart();
+      debug_printf ("Entering launch phase \"%s\"\n",
+		    launch_phases[phase].name);
+    }  /* enter */
+
+  /* Start the current phase's deadline over. */
+  void restart()
+    {
+      entered = get_seconds();
+      const double timeout = launch_phases[phase].timeout;
+      deadline = (timeout > 0 ? entered + timeout : 0);
+    }  /* restart */
+
+  /* The current phase's deadline, or 0 if it doesn't have one. */
+  double get_deadline() const { return deadline; }
+
+  /* Wait for latch_ to open, or for the current phase to stall.
+     While watching the application, wake up now and then to check on
+     it. */
+  void wait (latch_t &latch_)
+    {
+      const double watch_interval = 0.1;
+      for (;;)
+	{
+	  double until = deadline;
+	  if (watching())
+	    {
+	      const double wakeup = get_seconds() + watch_interval;
+	      if (0 == until || wakeup < until)
+		until = wakeup;
+	    }  /* if */
+	  if (latch_.wait_thread_until (until))
+	    return;
+	  check();
+	}  /* for */
+    }  /* wait */
+
+  /* Check whether the current phase has stalled, or the application
+     has shown that it isn't a PMIx application, for polling waits. */
+  void check()
+    {
+      if (watching())
+	{
+	  std::string diagnostic;
+	  if (app_watch->terminated_early (diagnostic))
+	    not_pmix (diagnostic);
+	  if (0 != launch_completed && 0 != pmix_grace &&
+	      get_seconds() >= launch_completed + pmix_grace &&
+	      0 == app_watch->get_nready())
+	    not_pmix (form_string ("No process of job '%s' called PMIx_Init() "
+				   "within %.0f seconds of being launched",
+				   app_nspace.c_str(),
+				   pmix_grace));
+	}  /* if */
+      if (0 != deadline && get_seconds() >= deadline)
+	stalled();
+    }  /* check */
+
+  /* Note that the launch has completed, which starts the grace period
+     for the application to show that it uses PMIx. */
+  void set_launch_completed()
+    {
+      launch_completed = get_seconds();
+    }  /* set_launch_completed */
+
+  /* Report the stall, kill the job and exit. */
+  void stalled();
+
+  /* Report that the application isn't a PMIx application, kill the
+     job and exit. */
+  void not_pmix (const std::string &diagnostic_);
+
+  app_watch_t *app_watch;		/* Set while the processes are held */
+
+  std::string launcher_nspace;		/* Set once the launcher is spawned */
+  pid_t launcher_pid;			/* A proxy run's launcher, -1 if gone, or 0 */
+  std::string app_nspace;		/* Set once the launch completes */
+  std::vector<pid_t> older_children;	/* Our children from before the launcher */
+
+ private:
+  /* Is the application being watched?  Only until it's released. */
+  bool watching() const
+    {
+      return NULL != app_watch && phase < phase_running;
+    }  /* watching */
+
+  /* Kill the job and exit. */
+  void abort_launch();
+
+  launch_phase_t phase;
+  double entered;
+  double deadline;
+  double launch_completed;		/* When, or 0 if it hasn't */
+};  /* launch_state_t */
+
+static launch_state_t launch_state;
+
+/* Return the (pid, parent pid) of every process we can see, or an
+ * empty vector if we can't tell. */
+
+typedef std::vector<std::pair<pid_t, pid_t> > process_parents_t;
+
+static process_parents_t
+get_process_parents()
+{
+  process_parents_t processes;
+  DIR *dir = opendir ("/proc");
+  if (!dir)
+    return processes;
+  while (struct dirent *entry = readdir (dir))
+    {
+      if (entry->d_name[0] < '0' || entry->d_name[0] > '9')
+	continue;
+      FILE *file = fopen (form_string ("/proc/%s/stat", entry->d_name).c_str(), "r");
+      if (!file)
+	continue;
+				/* "PID (COMM) STATE PPID ...", COMM may have ')' */
+      char line[1024];
+      const char *paren;
+      int ppid;
+      if (fgets (line, sizeof (line), file) &&
+	  NULL != (paren = strrchr (line, ')')) &&
+	  1 == sscanf (paren + 1, " %*c %d", &ppid))
+	processes.push_back (std::make_pair (pid_t (atoi (entry->d_name)),
+					     pid_t (ppid)));
+      fclose (file);
+    }  /* while */
+  closedir (dir);
+  return processes;
+}  /* get_process_parents */
+
+/* Return the process ids of our children, or an empty vector if we
+ * can't tell. */
+
+static std::vector<pid_t>
+get_child_pids()
+{
+  const process_parents_t processes = get_process_parents();
+  const pid_t self = getpid();
+  std::vector<pid_t> children;
+  for (size_t n = 0; n < processes.size(); n++)
+    if (self == processes[n].second)
+      children.push_back (processes[n].first);
+  return children;
+}  /* get_child_pids */
+
+/* Return the one child we've started since older_children_, -1 if
+ * there is none (it has already exited and been reaped), or 0 if there
+ * is more than one. */
+
+static pid_t
+get_new_child (const std::vector<pid_t> &older_children_)
+{
+  const std::vector<pid_t> children = get_child_pids();
+  pid_t new_child = -1;
+  for (size_t n = 0; n < children.size(); n++)
+    {
+      if (older_children_.end() != std::find (older_children_.begin(),
+					      older_children_.end(), children[n]))
+	continue;
+      if (-1 != new_child)
+	return 0;
+      new_child = children[n];
+    }  /* for */
+  return new_child;
+}  /* get_new_child */
+
+/* Has the launcher of a proxy run exited?  If so, describe how in
+ * how_.  The launcher is the PMIx library's child as much as ours, so
+ * leave it for the library to reap. */
+
+static bool
+launcher_has_exited (std::string &how_)
+{
+  const pid_t pid = launch_state.launcher_pid;
+  if (0 == pid)
+    return false;
+  if (pid < 0)
+    {
+      how_ = "and was reaped";		/* Before we could find it */
+      return true;
+    }  /* if */
+  siginfo_t info;
+  memset (&info, 0, sizeof (info));
+  if (0 == waitid (P_PID, pid, &info, WEXITED | WNOHANG | WNOWAIT))
+    {
+      if (pid != info.si_pid)
+	return false;
+      how_ = (CLD_EXITED == info.si_code
+	      ? form_string ("with status %d", info.si_status)
+	      : form_string ("on signal %d", info.si_status));
+      return true;
+    }  /* if */
+  if (ECHILD != errno)
+    return false;
+  how_ = "and was reaped";		/* By the PMIx library */
+  return true;
+}  /* launcher_has_exited */
+
+/* Kill the children we've started since older_children_ (the launcher
+ * of a proxy run) and all of their descendants, such as the daemons
+ * the launcher forked or the ssh processes it started them with, first
+ * politely and then not.  The launcher is spawned in our process
+ * group, so we can't just kill its group.  Descendants that have
+ * daemonized away from the launcher are out of reach, and are left to
+ * the server's kill_job(). */
+
+static void
+kill_new_children (const std::vector<pid_t> &older_children_)
+{
+  const process_parents_t processes = get_process_parents();
+  const pid_t self = getpid();
+  std::vector<pid_t> children;
+  std::vector<pid_t> killed;
+  for (size_t n = 0; n < processes.size(); n++)
+    {
+      const pid_t pid = processes[n].first;
+      if (self != processes[n].second ||
+	  older_children_.end() != std::find (older_children_.begin(),
+					      older_children_.end(), pid))
+	continue;
+      children.push_back (pid);
+      killed.push_back (pid);
+    }  /* for */
+
+				/* killed grows as we find each generation */
+  for (size_t k = 0; k < killed.size(); k++)
+    for (size_t n = 0; n < processes.size(); n++)
+      if (killed[k] == processes[n].second)
+	killed.push_back (processes[n].first);
+
+  for (size_t k = 0; k < killed.size(); k++)
+    {
+      debug_printf ("Killing process %d\n", int (killed[k]));
+      kill (killed[k], SIGTERM);
+    }  /* for */
+
+  const double grace = 5;
+  const double deadline = get_seconds() + grace;
+  for (size_t n = 0; n < children.size(); n++)
+    while (0 == waitpid (children[n], NULL, WNOHANG) && get_seconds() < deadline)
+      usleep (10 * 1000);
+  for (size_t k = children.size(); k < killed.size(); k++)
+    while (0 == kill (killed[k], 0) && get_seconds() < deadline)
+      usleep (10 * 1000);
+  for (size_t k = 0; k < killed.size(); k++)
+    if (0 == kill (killed[k], 0))
+      kill (killed[k], SIGKILL);
+}  /* kill_new_children */
+
+/* Ask the server to kill the application and the launcher, and wait a
+ * little while for it to say it has. */
+
+static void
+kill_job (const std::string &launcher_nspace_, const std::string &app_nspace_)
+{
+  NOTE_ENTRY_EXIT();
+
+  std::vector<pmix::proc_t> targets;
+  if (!app_nspace_.empty())
+    targets.push_back (pmix::proc_t (app_nspace_.c_str(), PMIX_RANK_WILDCARD));
+  if (!launcher_nspace_.empty())
+    targets.push_back (pmix::proc_t (launcher_nspace_.c_str(), PMIX_RANK_WILDCARD));
+  if (targets.empty())
+    return;
+
+  const double kill_timeout = 10;
+  pmix::info_t directive (PMIX_JOB_CTRL_KILL, true);
+  query_data_t *query_data = new query_data_t;
+  pmix::status_t rc = PMIx_Job_control_nb (&targets.front(), targets.size(),
+					   &directive, 1,
+					   query_callback_fn, (void *) query_data);
+  if (PMIX_SUCCESS != rc)
+    {
+      debug_printf ("Killing the job failed: %s\n", PMIx_Error_string (rc));
+      delete query_data;
+      return;
+    }  /* if */
+  if (!query_data->latch.wait_thread_until (get_seconds() + kill_timeout))
+    {
+				/* The callback still owns query_data */
+      debug_printf ("No reply to killing the job after %.0f seconds\n",
+		    kill_timeout);
+      return;
+    }  /* if */
+  if (PMIX_SUCCESS != query_data->status)
+    debug_printf ("Killing the job failed: %s\n",
+		  PMIx_Error_string (query_data->status));
+  delete query_data;
+}  /* kill_job */
+
+void
+launch_state_t::stalled()
+{
+  fprintf (stderr,
+	   "%s: ERROR: The launch stalled in phase \"%s\": "
+	   "no sign of %s after %.0f seconds.  Killing the job.\n",
+	   whoami,
+	   launch_phases[phase].name,
+	   launch_phases[phase].waiting_for,
+	   get_seconds() - entered);
+  abort_launch();
+}  /* launch_state_t::stalled */
+
+void
+launch_state_t::not_pmix (const std::string &diagnostic_)
+{
+  fprintf (stderr,
+	   "%s: ERROR: %s.  The application doesn't appear to use PMIx, "
+	   "so it can't be launched for debugging through %s.  Killing the job.\n",
+	   whoami,
+	   diagnostic_.c_str(),
+	   whoami);
+  abort_launch();
+}  /* launch_state_t::not_pmix */
+
+void
+launch_state_t::abort_launch()
+{
+  phase_times.report();
+  kill_job (launcher_nspace, app_nspace);
+  (void) PMIx_tool_finalize();
+  kill_new_children (older_children);
+  exit (1);
+}  /* launch_state_t::abort_launch */
+
 /**********************************************************************/
 /* This is the default event notification function we pass down below
  * when registering for general events.  We don't technically need to
@@ -1015,33 +2781,6 @@ default_notification_fn (size_t evhdlr_registration_id_,
     cbfunc_ (PMIX_SUCCESS, NULL, 0, NULL, NULL, cbdata_);
 }  /* default_notification_fn */
 
-/**********************************************************************/
-/* Event handler registration is done asynchronously because it may
- * involve the PMIx server registering with the host RM for external
- * events.  So we provide a callback function that returns the status of
- * the request (success or an error), plus a numerical index to the
- * registered event.  The index is used later on to deregister an event
- * handler - if we don't explicitly deregister it, then the PMIx server
- * will do so when it see us exit.
- */
-
-static void
-evhandler_reg_callbk (pmix_status_t status_,
-		      size_t evhandler_ref_,
-		      void *cbdata_)
-{
-  NOTE_ENTRY_EXIT();
-
-  lock_t *lock = (lock_t *) cbdata_;
-  if (PMIX_SUCCESS != status_)
-    pmix_fatal_error (status_,
-		      "Event handler registration failed: "
-		      "evhandler_ref_=%lu",
-		      (unsigned long) evhandler_ref_);
-  lock->status = status_;
-  lock->wakeup_thread();
-}  /* evhandler_reg_callbk */
-
 /**********************************************************************/
 /* This is an event notification function that we explicitly request
  * be called when the PMIX_ERR_JOB_TERMINATED notification is issued
@@ -1114,12 +2853,14 @@ launcher_release_fn (size_t evhdlr_registration_id_,
 	  release->exit_code = exit_code;
 	  release->exit_code_given = true;
 	}  /* if */
+      if (child_jobs)
+	child_jobs->set_done();
     }  /* else */
 
   /*
    * Release the main thread.
    */
-  release->lock.wakeup_thread();
+  release->latch.wakeup_thread();
 
   /*
    * Tell the event handler state machine that we are the last step.
@@ -1149,6 +2890,7 @@ debugger_release_fn (size_t evhdlr_registration_id_,
   NOTE_ENTRY_EXIT();
 
   const char *app_nspace = 0;
+  const char *parent = NULL;
   release_t *release = NULL;
 
   /*
@@ -1168,6 +2910,9 @@ debugger_release_fn (size_t evhdlr_registration_id_,
 	  debug_printf ("PMIX_EVENT_RETURN_OBJECT key found: pointer '%p'\n",
 			release);
 	}  /* else-if */
+      else if (PMIX_CHECK_KEY (&info_[n], PMIX_PARENT_ID) &&
+	       PMIX_PROC == info_[n].value.type)
+	parent = info_[n].value.data.proc->nspace;
     }  /* for */
 
   /*
@@ -1185,12 +2930,29 @@ debugger_release_fn (size_t evhdlr_registration_id_,
     pmix_fatal_error (PMIX_SUCCESS,
 		      "Launched application namespace wasn't returned in callback");
 
+  /*
+   * If we already have the application's namespace, this launch is a
+   * child job, for example one started by MPI_Comm_spawn().
+   */
+  if (NULL != release->nspace)
+    {
+      debug_printf ("Child job namespace is '%s'\n",
+		    app_nspace);
+      if (child_jobs)
+	child_jobs->add (app_nspace, parent);
+      if (NULL != cbfunc_)
+	cbfunc_ (PMIX_EVENT_ACTION_COMPLETE, NULL, 0, NULL, NULL, cbdata_);
+      return;
+    }  /* if */
+
   /*
    * Copy the namespace of the application into the release object.
    */
   debug_printf ("Application namespace is '%s'\n",
 		app_nspace);
   release->nspace = strdup (app_nspace);
+  if (child_jobs)
+    child_jobs->add_non_child (app_nspace, true);
 
   /*
    * Tell the event handler state machine that we are the last step
@@ -1201,82 +2963,938 @@ debugger_release_fn (size_t evhdlr_registration_id_,
   /*
    * Release the main thread.
    */
-  release->lock.wakeup_thread();
+  release->latch.wakeup_thread();
+  if (proctable_stream)
+    proctable_stream->set_launch_complete (app_nspace);
 }  /* debugger_release_fn */
 
 /**********************************************************************/
-/* Extract the PMIx proc table and use it to fill-in the MPIR proc
- * table.  Then, call MPIR_Breakpoint() to notify the debugger that is
- * debugging this process.
+/* This is an event notification function that we request be called
+ * when a job starts.  Any job we haven't seen before is a child job,
+ * created by one of the application's processes.
  */
 
 static void
-pmix_proc_table_to_mpir (const char *app_nspace_)
+child_job_fn (size_t evhdlr_registration_id_,
+	      pmix_status_t status_,
+	      const pmix_proc_t *source_,
+	      pmix_info_t info_[], size_t ninfo_,
+	      pmix_info_t results_[], size_t nresults_,
+	      pmix_event_notification_cbfunc_fn_t cbfunc_,
+	      void *cbdata_)
 {
   NOTE_ENTRY_EXIT();
 
-  pmix::status_t rc;
+  child_jobs_t *children = NULL;
+  const char *nspace = NULL;
+  const char *parent = NULL;
+  for (size_t n = 0; n < ninfo_; n++)
+    {
+      if (PMIX_CHECK_KEY (&info_[n], PMIX_EVENT_RETURN_OBJECT))
+	children = (child_jobs_t *) info_[n].value.data.ptr;
+      else if (PMIX_CHECK_KEY (&info_[n], PMIX_NSPACE))
+	nspace = info_[n].value.data.string;
+      else if (PMIX_CHECK_KEY (&info_[n], PMIX_EVENT_AFFECTED_PROC) && NULL == nspace)
+	nspace = info_[n].value.data.proc->nspace;
+      else if (PMIX_CHECK_KEY (&info_[n], PMIX_PARENT_ID) &&
+	       PMIX_PROC == info_[n].value.type)
+	parent = info_[n].value.data.proc->nspace;
+    }  /* for */
+  if (NULL == nspace && NULL != source_)
+    nspace = source_->nspace;
 
-  /*
-   * Extract proc table for the application namespace.
-   */
-  pmix::query_t query;
-  PMIX_ARGV_APPEND (rc, query.keys, PMIX_QUERY_PROC_TABLE);
-  query.qualifiers = new pmix::info_t (PMIX_NSPACE, app_nspace_);
-  query.nqual = 1;
-  query_data_t query_data;
-  rc = PMIx_Query_info_nb (&query, 1, query_callback_fn, (void *) &query_data);
-  if (PMIX_SUCCESS != rc)
-    pmix_fatal_error (rc, "PMIx_Query_info_nb() failed");
+  if (NULL == children)
+    pmix_fatal_error (PMIX_SUCCESS,
+		      "Child jobs object wasn't returned in callback");
 
-  /*
-   * Wait for a response.
-   */
-  debug_printf ("Waiting for proc table query response\n");
-  query_data.lock.wait_thread();
-  debug_printf ("Proc table query response received\n");
+  debug_printf ("Job started: namespace '%s', parent '%s'\n",
+		nspace ? nspace : "NULL",
+		parent ? parent : "unknown");
+  if (NULL != nspace)
+    children->add (nspace, parent);
 
-  /*
-   * Check the query data status, info/ninfo, and data type (which
-   * should be a data array).
-   */
-  if (PMIX_SUCCESS != query_data.status)
-    pmix_fatal_error (rc, "PMIx proc table status error");
-  if (NULL == query_data.info || 0 == query_data.ninfo)
-    pmix_fatal_error (rc, "PMIx proc table info/ninfo is 0");
-  if (PMIX_DATA_ARRAY != query_data.info[0].value.type)
-    pmix_fatal_error (rc, "PMIx proc table has incorrect data type: %s (%d)",
-		      PMIx_Data_type_string (query_data.info[0].value.type),
-		      (int) query_data.info[0].value.type);
-  if (NULL == query_data.info[0].value.data.darray->array)
-    pmix_fatal_error (rc, "PMIx proc table data array is null");
-  if (PMIX_PROC_INFO != query_data.info[0].value.data.darray->type)
-    pmix_fatal_error (rc, "PMIx proc table data array has incorrect type: %s (%d)",
-		      PMIx_Data_type_string (query_data.info[0].value.data.darray->type),
-		      (int) query_data.info[0].value.data.darray->type);
+  if (NULL != cbfunc_)
+    cbfunc_ (PMIX_EVENT_ACTION_COMPLETE, NULL, 0, NULL, NULL, cbdata_);
+}  /* child_job_fn */
 
-  /*
-   * The data array consists of a struct:
-   *     size_t size;
-   *     void* array;
-   *
-   * In this case, the array is composed of pmix_proc_info_t structs:
-   *     pmix_proc_t proc;   // contains the nspace,rank of this proc
-   *     char* hostname;
-   *     char* executable_name;
-   *     pid_t pid;
-   *     int exit_code;
-   *     pmix_proc_state_t state;
-   */
-  const size_t nprocs = query_data.info[0].value.data.darray->size;
-  const pmix_proc_info_t *proc_info =
-    (pmix_proc_info_t *) query_data.info[0].value.data.darray->array;
-  if (debug_output)
+/**********************************************************************/
+/* This is an event notification function that we request be called
+ * when an application process reports PMIX_READY_FOR_DEBUG, meaning
+ * it has stopped in PMIx_Init() and is waiting for the debugger.  The
+ * source of the event is the ready process, or the whole job if its
+ * rank is PMIX_RANK_WILDCARD.
+ */
+
+static void
+ready_for_debug_fn (size_t evhdlr_registration_id_,
+		    pmix_status_t status_,
+		    const pmix_proc_t *source_,
+		    pmix_info_t info_[], size_t ninfo_,
+		    pmix_info_t results_[], size_t nresults_,
+		    pmix_event_notification_cbfunc_fn_t cbfunc_,
+		    void *cbdata_)
+{
+  stream_t *stream = NULL;
+  for (size_t n = 0; n < ninfo_; n++)
     {
-      debug_printf ("Received PMIx proc table for %lu procs:\n",
-		    (unsigned long) nprocs);
-      for (int i = 0; i < nprocs; i++)
-	{
+      if (PMIX_CHECK_KEY (&info_[n], PMIX_EVENT_RETURN_OBJECT))
+	stream = (stream_t *) info_[n].value.data.ptr;
+    }  /* for */
+
+  if (NULL == stream)
+    pmix_fatal_error (PMIX_SUCCESS,
+		      "Stream object wasn't returned in callback");
+
+  if (NULL != source_)
+    stream->add_ready (source_->nspace, source_->rank);
+
+  if (NULL != cbfunc_)
+    cbfunc_ (PMIX_EVENT_ACTION_COMPLETE, NULL, 0, NULL, NULL, cbdata_);
+}  /* ready_for_debug_fn */
+
+/**********************************************************************/
+/* This is an event notification function that we request be called
+ * when application processes become ready for the debugger or
+ * terminate, while they are held for the debugger.  It passes the
+ * events on to the other handlers.
+ */
+
+static void
+app_watch_fn (size_t evhdlr_registration_id_,
+	      pmix_status_t status_,
+	      const pmix_proc_t *source_,
+	      pmix_info_t info_[], size_t ninfo_,
+	      pmix_info_t results_[], size_t nresults_,
+	      pmix_event_notification_cbfunc_fn_t cbfunc_,
+	      void *cbdata_)
+{
+  app_watch_t *watch = NULL;
+  const pmix_proc_t *affected_proc = source_;
+  int exit_code = 0;
+  for (size_t n = 0; n < ninfo_; n++)
+    {
+      if (PMIX_CHECK_KEY (&info_[n], PMIX_EVENT_RETURN_OBJECT))
+	watch = (app_watch_t *) info_[n].value.data.ptr;
+      else if (PMIX_CHECK_KEY (&info_[n], PMIX_EVENT_AFFECTED_PROC))
+	affected_proc = info_[n].value.data.proc;
+      else if (PMIX_CHECK_KEY (&info_[n], PMIX_EXIT_CODE))
+	exit_code = info_[n].value.data.integer;
+    }  /* for */
+
+  if (NULL == watch)
+    pmix_fatal_error (PMIX_SUCCESS,
+		      "App watch object wasn't returned in callback");
+
+  if (NULL != affected_proc)
+    {
+      debug_printf ("App watch event %s for '%s' rank %u\n",
+		    PMIx_Error_string (status_),
+		    affected_proc->nspace,
+		    (unsigned int) affected_proc->rank);
+      watch->add_event (affected_proc->nspace, affected_proc->rank,
+			PMIX_READY_FOR_DEBUG == status_, exit_code, status_);
+    }  /* if */
+
+  if (NULL != cbfunc_)
+    cbfunc_ (PMIX_EVENT_NO_ACTION_TAKEN, NULL, 0, NULL, NULL, cbdata_);
+}  /* app_watch_fn */
+
+/**********************************************************************/
+/* Parallel proc table conversion.  For very large jobs, the PMIx proc
+ * table is split into contiguous slices, one per thread.  Each thread
+ * interns the strings for its slice into its own private string
+ * tables (a "shard"), so the threads never contend on a lock.  Then
+ * the main thread merges each shard's (few) unique strings into the
+ * global string tables, and finally each thread rewrites its slice of
+ * MPIR_proctable to point at the global strings.
+ */
+
+struct convert_shard_t
+{
+  const pmix_proc_info_t *proc_info;	/* First proc in the slice */
+  MPIR_PROCDESC *procdesc;		/* First MPIR entry for the slice */
+  uint32_t *host_ids;			/* First string ids for the slice */
+  uint32_t *exec_ids;
+  size_t nprocs;			/* Number of procs in the slice */
+  string_table_t hostnames;		/* Shard-local string tables */
+  string_table_t executables;
+  std::vector<uint32_t> host_map;	/* Shard-local to global string ids */
+  std::vector<uint32_t> exec_map;
+
+  convert_shard_t()
+    : proc_info(0), procdesc(0), host_ids(0), exec_ids(0), nprocs(0) {}
+};  /* convert_shard_t */
+
+/* Phase 1: intern the slice's strings into the shard-local tables. */
+
+static void *
+convert_shard_intern (void *arg_)
+{
+  convert_shard_t *shard = (convert_shard_t *) arg_;
+  for (size_t i = 0; i < shard->nprocs; i++)
+    {
+      const pmix_proc_info_t *p = shard->proc_info + i;
+      shard->hostnames.intern (p->hostname, &shard->host_ids[i]);
+      shard->executables.intern (p->executable_name, &shard->exec_ids[i]);
+      shard->procdesc[i].pid = p->pid;
+    }  /* for */
+  return 0;
+}  /* convert_shard_intern */
+
+/* Phase 2: point the slice's MPIR entries at the global strings. */
+
+static void *
+convert_shard_remap (void *arg_)
+{
+  convert_shard_t *shard = (convert_shard_t *) arg_;
+  for (size_t i = 0; i < shard->nprocs; i++)
+    {
+      const uint32_t host_id = shard->host_map[shard->host_ids[i]];
+      const uint32_t exec_id = shard->exec_map[shard->exec_ids[i]];
+      shard->host_ids[i] = host_id;
+      shard->exec_ids[i] = exec_id;
+      shard->procdesc[i].host_name = mpir_hostnames.string (host_id);
+      shard->procdesc[i].executable_name = mpir_executables.string (exec_id);
+    }  /* for */
+  return 0;
+}  /* convert_shard_remap */
+
+/* Run func_ on every shard, using the calling thread for shard 0. */
+
+static void
+run_convert_shards (std::vector<convert_shard_t *> &shards_,
+		    void *(*func_) (void *))
+{
+  std::vector<pthread_t> threads (shards_.size());
+  size_t nstarted = 1;
+  int err = 0;
+  for (; nstarted < shards_.size(); nstarted++)
+    {
+      err = pthread_create (&threads[nstarted], 0, func_, shards_[nstarted]);
+      if (0 != err)
+	break;
+    }  /* for */
+  if (0 == err)
+    func_ (shards_[0]);
+
+  /* Never exit while workers are still touching the tables. */
+  for (size_t t = 1; t < nstarted; t++)
+    pthread_join (threads[t], 0);
+  if (0 != err)
+    fatal_error ("pthread_create() failed: %s",
+		 get_errno_string (err).c_str());
+}  /* run_convert_shards */
+
+/**********************************************************************/
+/* Fill in nprocs_ MPIR_PROCDESC entries from the PMIx proc info,
+ * sharing the host and executable name strings.  The id of each
+ * entry's strings in mpir_hostnames and mpir_executables is returned
+ * in host_ids_ and exec_ids_.  Large tables are converted in parallel.
+ */
+
+static void
+convert_proc_info (MPIR_PROCDESC *procdesc_,
+		   uint32_t *host_ids_,
+		   uint32_t *exec_ids_,
+		   const pmix_proc_info_t *proc_info_,
+		   size_t nprocs_)
+{
+  NOTE_ENTRY_EXIT();
+
+  const double start = get_seconds();
+  const long ncpus = sysconf (_SC_NPROCESSORS_ONLN);	/* -1 if unknown */
+  size_t nthreads = (proctable_threads > 0
+		     ? proctable_threads
+		     : size_t (std::max (ncpus, 1L)));
+  if (nprocs_ < parallel_conversion_threshold || nthreads < 2)
+    nthreads = 1;
+
+  if (1 == nthreads)
+    {
+      for (size_t i = 0; i < nprocs_; i++)
+	{
+	  const pmix_proc_info_t *p = proc_info_ + i;
+	  procdesc_[i].host_name = mpir_hostnames.intern (p->hostname, &host_ids_[i]);
+	  procdesc_[i].executable_name = mpir_executables.intern (p->executable_name, &exec_ids_[i]);
+	  procdesc_[i].pid = p->pid;
+	}  /* for */
+    }  /* if */
+  else
+    {
+      /*
+       * Split the procs into nearly equal contiguous slices.
+       */
+      std::vector<convert_shard_t *> shards (nthreads);
+      const size_t per_shard = nprocs_ / nthreads;
+      const size_t extra = nprocs_ % nthreads;
+      size_t begin = 0;
+      for (size_t t = 0; t < nthreads; t++)
+	{
+	  shards[t] = new convert_shard_t;
+	  shards[t]->proc_info = proc_info_ + begin;
+	  shards[t]->procdesc = procdesc_ + begin;
+	  shards[t]->host_ids = host_ids_ + begin;
+	  shards[t]->exec_ids = exec_ids_ + begin;
+	  shards[t]->nprocs = per_shard + (t < extra ? 1 : 0);
+	  begin += shards[t]->nprocs;
+	}  /* for */
+
+      run_convert_shards (shards, convert_shard_intern);
+
+      /*
+       * Merge the shard-local strings into the global tables.
+       */
+      for (size_t t = 0; t < nthreads; t++)
+	{
+	  convert_shard_t &shard = *shards[t];
+	  shard.host_map.resize (shard.hostnames.size());
+	  for (uint32_t id = 0; id < shard.hostnames.size(); id++)
+	    mpir_hostnames.intern (shard.hostnames.string (id), &shard.host_map[id]);
+	  shard.exec_map.resize (shard.executables.size());
+	  for (uint32_t id = 0; id < shard.executables.size(); id++)
+	    mpir_executables.intern (shard.executables.string (id), &shard.exec_map[id]);
+	}  /* for */
+
+      run_convert_shards (shards, convert_shard_remap);
+
+      for (size_t t = 0; t < nthreads; t++)
+	delete shards[t];
+    }  /* else */
+
+  debug_printf ("Converted %lu procs using %lu thread(s) in %.6f seconds\n",
+		(unsigned long) nprocs_,
+		(unsigned long) nthreads,
+		get_seconds() - start);
+}  /* convert_proc_info */
+
+/**********************************************************************/
+/* The procs selected with "--attach-ranks" and "--attach-hosts".  A
+ * proc is selected if it matches either selector.  If neither option
+ * is given, every proc is selected.
+ */
+
+class attach_selector_t
+{
+ public:
+  attach_selector_t() : has_ranks(false) {}
+
+  /* Is a subset selected? */
+  bool active() const		{ return has_ranks || !hosts.empty(); }
+
+  /* Add the ranks in a list such as "0-3,17".  Returns false if the
+     list is malformed. */
+  bool add_ranks (const char *list_)
+    {
+      const char *p = list_;
+      while (*p)
+	{
+	  char *end;
+	  const unsigned long first = strtoul (p, &end, 10);
+	  unsigned long last = first;
+	  if (end == p)
+	    return false;
+	  p = end;
+	  if ('-' == *p)
+	    {
+	      last = strtoul (++p, &end, 10);
+	      if (end == p || last < first)
+		return false;
+	      p = end;
+	    }  /* if */
+	  if (',' == *p)
+	    p++;
+	  else if ('\0' != *p)
+	    return false;
+	  ranges.push_back (std::make_pair (pmix::rank_t (first), pmix::rank_t (last)));
+	}  /* while */
+      has_ranks = true;
+      return true;
+    }  /* add_ranks */
+
+  /* Add the hosts in a comma-separated list. */
+  void add_hosts (const char *list_)
+    {
+      while (*list_)
+	{
+	  const char *comma = strchr (list_, ',');
+	  const size_t len = (comma ? comma - list_ : strlen (list_));
+	  if (len)
+	    hosts.push_back (std::string (list_, len));
+	  list_ += len + (comma ? 1 : 0);
+	}  /* while */
+    }  /* add_hosts */
+
+  /* Is the host with this id in mpir_hostnames selected?  Each id is
+     looked up once and remembered, so no host name is compared more
+     than once. */
+  bool selects_host (uint32_t host_id_)
+    {
+      if (host_id_ >= host_state.size())
+	host_state.resize (mpir_hostnames.size(), 0);
+      if (0 == host_state[host_id_])
+	{
+	  const char *name = mpir_hostnames.string (host_id_);
+	  bool found = false;
+	  for (size_t n = 0; n < hosts.size() && !found; n++)
+	    found = (hosts[n] == name);
+	  host_state[host_id_] = (found ? 1 : 2);
+	}  /* if */
+      return 1 == host_state[host_id_];
+    }  /* selects_host */
+
+  bool selects_rank (pmix::rank_t rank_) const
+    {
+      for (size_t n = 0; n < ranges.size(); n++)
+	if (ranges[n].first <= rank_ && rank_ <= ranges[n].second)
+	  return true;
+      return false;
+    }  /* selects_rank */
+
+  /* Is this proc selected? */
+  bool selects (pmix::rank_t rank_, uint32_t host_id_)
+    {
+      return (!active() ||
+	      selects_rank (rank_) ||
+	      (!hosts.empty() && selects_host (host_id_)));
+    }  /* selects */
+
+ private:
+  bool has_ranks;
+  std::vector<std::pair<pmix::rank_t, pmix::rank_t> > ranges;
+  std::vector<std::string> hosts;
+  std::vector<char> host_state;		/* By host id: 0 unknown, 1 yes, 2 no */
+};  /* attach_selector_t */
+
+static attach_selector_t attach_selector;
+
+/**********************************************************************/
+/* The proc table that MPIR_proctable is published from.  Replies to
+ * proc table queries are appended to it (possibly from several
+ * callbacks at once), and when all of them have arrived it's put in
+ * order and published.  Besides the MPIR_PROCDESC entries it keeps,
+ * for each entry, the ids of its strings in mpir_hostnames and
+ * mpir_executables, its namespace's id in mpir_nspaces (child jobs
+ * share the table with the application), its PMIx rank, state and
+ * exit code, and its rank on its host and application number.
+ */
+
+class proc_table_t
+{
+ public:
+  std::vector<MPIR_PROCDESC> procdesc;
+  std::vector<uint32_t> host_ids;
+  std::vector<uint32_t> exec_ids;
+  std::vector<uint32_t> nspace_ids;
+  std::vector<pmix::rank_t> ranks;
+  std::vector<int> states;
+  std::vector<int> exit_codes;
+  std::vector<int> host_ranks;
+  std::vector<uint32_t> appnums;
+
+  proc_table_t()
+    {
+      pthread_mutex_init (&mutex, NULL);
+    }  /* proc_table_t */
+
+  ~proc_table_t()
+    {
+      pthread_mutex_destroy (&mutex);
+    }  /* ~proc_table_t */
+
+  size_t size() const		{ return procdesc.size(); }
+
+  /* Remove all of the entries. */
+  void clear()
+    {
+      procdesc.clear();
+      host_ids.clear();
+      exec_ids.clear();
+      nspace_ids.clear();
+      ranks.clear();
+      states.clear();
+      exit_codes.clear();
+      host_ranks.clear();
+      appnums.clear();
+    }  /* clear */
+
+  /* Append a copy of entry i_ of another table. */
+  void append_entry (const proc_table_t &from_, size_t i_)
+    {
+      pthread_mutex_lock (&mutex);
+      procdesc.push_back (from_.procdesc[i_]);
+      host_ids.push_back (from_.host_ids[i_]);
+      exec_ids.push_back (from_.exec_ids[i_]);
+      nspace_ids.push_back (from_.nspace_ids[i_]);
+      ranks.push_back (from_.ranks[i_]);
+      states.push_back (from_.states[i_]);
+      exit_codes.push_back (from_.exit_codes[i_]);
+      host_ranks.push_back (from_.host_ranks[i_]);
+      appnums.push_back (from_.appnums[i_]);
+      pthread_mutex_unlock (&mutex);
+    }  /* append_entry */
+
+  /* Convert and append nprocs_ procs.  Safe to call from several
+     threads at once. */
+  void append (const pmix_proc_info_t *proc_info_, size_t nprocs_)
+    {
+      if (0 == nprocs_)
+	return;
+      pthread_mutex_lock (&mutex);
+      const size_t base = procdesc.size();
+      procdesc.resize (base + nprocs_);
+      host_ids.resize (base + nprocs_);
+      exec_ids.resize (base + nprocs_);
+      nspace_ids.resize (base + nprocs_);
+      ranks.resize (base + nprocs_);
+      states.resize (base + nprocs_);
+      exit_codes.resize (base + nprocs_);
+      host_ranks.resize (base + nprocs_, 0);
+      appnums.resize (base + nprocs_, 0);
+      convert_proc_info (&procdesc[base], &host_ids[base], &exec_ids[base],
+			 proc_info_, nprocs_);
+      for (size_t i = 0; i < nprocs_; i++)
+	{
+	  mpir_nspaces.intern (proc_info_[i].proc.nspace, &nspace_ids[base + i]);
+	  ranks[base + i] = proc_info_[i].proc.rank;
+	  states[base + i] = proc_info_[i].state;
+	  exit_codes[base + i] = proc_info_[i].exit_code;
+	}  /* for */
+      pthread_mutex_unlock (&mutex);
+    }  /* append */
+
+  /* Put the entries in rank order.  If the ranks are exactly
+     0..size()-1, as they are for a whole job, MPIR_proctable ends up
+     indexed by rank, and each entry is placed directly, so it's O(n).
+     Otherwise the entries are sorted. */
+  void order_by_rank()
+    {
+      const size_t n = size();
+      std::vector<size_t> from (n, n);
+      bool dense = true;
+      for (size_t i = 0; i < n && dense; i++)
+	{
+	  dense = (ranks[i] < n && from[ranks[i]] == n);
+	  if (dense)
+	    from[ranks[i]] = i;
+	}  /* for */
+      if (!dense)
+	{
+	  debug_printf ("Proc table ranks are not dense, sorting them\n");
+	  for (size_t i = 0; i < n; i++)
+	    from[i] = i;
+	  std::stable_sort (from.begin(), from.end(), rank_less_t (ranks));
+	}  /* if */
+      permute (from);
+    }  /* order_by_rank */
+
+  /* Group the entries by host, in the order each host first appears,
+     keeping the existing order within each host.  This counts the
+     entries per host and places each one directly, so it's O(n). */
+  void order_by_host()
+    {
+      const size_t n = size();
+      uint32_t nhosts = 0;
+      for (size_t i = 0; i < n; i++)
+	if (host_ids[i] >= nhosts)
+	  nhosts = host_ids[i] + 1;
+
+      /*
+       * Number the hosts in order of first appearance, and count the
+       * entries on each.
+       */
+      const uint32_t unseen = ~uint32_t(0);
+      std::vector<uint32_t> bucket (nhosts, unseen);
+      std::vector<size_t> next;
+      for (size_t i = 0; i < n; i++)
+	{
+	  uint32_t &b = bucket[host_ids[i]];
+	  if (unseen == b)
+	    {
+	      b = next.size();
+	      next.push_back (0);
+	    }  /* if */
+	  next[b]++;
+	}  /* for */
+
+      /*
+       * Turn the counts into the starting index of each host's run,
+       * then place the entries.
+       */
+      size_t start = 0;
+      for (size_t b = 0; b < next.size(); b++)
+	{
+	  const size_t count = next[b];
+	  next[b] = start;
+	  start += count;
+	}  /* for */
+      std::vector<size_t> from (n);
+      for (size_t i = 0; i < n; i++)
+	from[next[bucket[host_ids[i]]]++] = i;
+      permute (from);
+    }  /* order_by_host */
+
+  /* Put the entries in the order selected with "--proctable-order". */
+  void order()
+    {
+      switch (proctable_order)
+	{
+	case order_rank:
+	  order_by_rank();
+	  break;
+	case order_host:
+	  order_by_rank();
+	  order_by_host();
+	  break;
+	case order_pmix:
+	  break;
+	}  /* switch */
+    }  /* order */
+
+  /* Remove the entries that attach_selector doesn't select, and append
+     their ranks to unselected_. */
+  void select (std::vector<pmix::rank_t> *unselected_)
+    {
+      const size_t n = size();
+      std::vector<size_t> from;
+      from.reserve (n);
+      for (size_t i = 0; i < n; i++)
+	{
+	  if (attach_selector.selects (ranks[i], host_ids[i]))
+	    from.push_back (i);
+	  else
+	    unselected_->push_back (ranks[i]);
+	}  /* for */
+      if (from.size() < n)
+	permute (from);
+    }  /* select */
+
+  /* Rearrange the entries so entry i is the old entry from_[i].  from_
+     may be shorter than the table, which drops the other entries. */
+  void permute (const std::vector<size_t> &from_)
+    {
+      permute_vector (procdesc, from_);
+      permute_vector (host_ids, from_);
+      permute_vector (exec_ids, from_);
+      permute_vector (nspace_ids, from_);
+      permute_vector (ranks, from_);
+      permute_vector (states, from_);
+      permute_vector (exit_codes, from_);
+      permute_vector (host_ranks, from_);
+      permute_vector (appnums, from_);
+    }  /* permute */
+
+ private:
+  /* Compares entry indexes by rank, for order_by_rank(). */
+  struct rank_less_t
+  {
+    const std::vector<pmix::rank_t> &ranks;
+    rank_less_t (const std::vector<pmix::rank_t> &ranks_) : ranks (ranks_) {}
+    bool operator() (size_t a_, size_t b_) const { return ranks[a_] < ranks[b_]; }
+  };  /* rank_less_t */
+
+  template <typename T>
+  static void permute_vector (std::vector<T> &v_, const std::vector<size_t> &from_)
+    {
+      std::vector<T> permuted (from_.size());
+      for (size_t i = 0; i < permuted.size(); i++)
+	permuted[i] = v_[from_[i]];
+      v_.swap (permuted);
+    }  /* permute_vector */
+
+  /* Prevent copying */
+  proc_table_t (const proc_table_t &);
+  proc_table_t &operator =(const proc_table_t &);
+
+  pthread_mutex_t mutex;
+};  /* proc_table_t */
+
+static proc_table_t mpir_table;
+
+/**********************************************************************/
+/* Copy mpir_table and all of the strings it points to into a single
+ * page-aligned region, and publish it as MPIR_proctable and through
+ * MPIR_shim_proctable_region.  The strings are copied in id order, so
+ * all of the host names come first, followed by the executable names.
+ * If huge_pages_ is set, try to back the region with huge pages.
+ * Returns false if the region cannot be allocated.
+ */
+
+static bool
+pack_proctable_region (bool huge_pages_)
+{
+  NOTE_ENTRY_EXIT();
+
+  const size_t nprocs = mpir_table.size();
+  const size_t table_size = nprocs * sizeof (MPIR_PROCDESC);
+  size_t strings_size = 0;
+  for (uint32_t id = 0; id < mpir_hostnames.size(); id++)
+    strings_size += mpir_hostnames.length (id) + 1;
+  for (uint32_t id = 0; id < mpir_executables.size(); id++)
+    strings_size += mpir_executables.length (id) + 1;
+
+  /*
+   * Round the region up to a whole number of (huge) pages.
+   */
+  const size_t huge_page_size = 2 * 1024 * 1024;
+  const size_t page_size = sysconf (_SC_PAGESIZE);
+  size_t region_size = table_size + strings_size;
+  char *region = (char *) MAP_FAILED;
+#if defined(MAP_HUGETLB)
+  if (huge_pages_)
+    {
+      const size_t huge_size = ((region_size + huge_page_size - 1)
+				/ huge_page_size * huge_page_size);
+      region = (char *) mmap (0, huge_size,
+			      PROT_READ | PROT_WRITE,
+			      MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB,
+			      -1, 0);
+      if (MAP_FAILED != region)
+	region_size = huge_size;
+      else
+	debug_printf ("Huge page mmap() of %lu bytes failed: %s\n",
+		      (unsigned long) huge_size,
+		      get_errno_string().c_str());
+    }  /* if */
+#endif
+  if (MAP_FAILED == region)
+    {
+      region_size = (region_size + page_size - 1) / page_size * page_size;
+      region = (char *) mmap (0, region_size,
+			      PROT_READ | PROT_WRITE,
+			      MAP_PRIVATE | MAP_ANONYMOUS,
+			      -1, 0);
+      if (MAP_FAILED == region)
+	{
+	  debug_printf ("mmap() of %lu bytes failed, not packing proc table: %s\n",
+			(unsigned long) region_size,
+			get_errno_string().c_str());
+	  return false;
+	}  /* if */
+#if defined(MADV_HUGEPAGE)
+      if (huge_pages_)
+	(void) madvise (region, region_size, MADV_HUGEPAGE);
+#endif
+    }  /* if */
+
+  /*
+   * Copy the strings, remembering where each one landed.
+   */
+  char *next = region + table_size;
+  std::vector<const char *> hosts (mpir_hostnames.size());
+  for (uint32_t id = 0; id < mpir_hostnames.size(); id++)
+    {
+      const size_t len = mpir_hostnames.length (id) + 1;
+      memcpy (next, mpir_hostnames.string (id), len);
+      hosts[id] = next;
+      next += len;
+    }  /* for */
+  std::vector<const char *> execs (mpir_executables.size());
+  for (uint32_t id = 0; id < mpir_executables.size(); id++)
+    {
+      const size_t len = mpir_executables.length (id) + 1;
+      memcpy (next, mpir_executables.string (id), len);
+      execs[id] = next;
+      next += len;
+    }  /* for */
+
+  /*
+   * Build the packed table, and make the whole region read-only.
+   */
+  MPIR_PROCDESC *table = (MPIR_PROCDESC *) region;
+  for (size_t i = 0; i < nprocs; i++)
+    {
+      table[i].host_name = hosts[mpir_table.host_ids[i]];
+      table[i].executable_name = execs[mpir_table.exec_ids[i]];
+      table[i].pid = mpir_table.procdesc[i].pid;
+    }  /* for */
+  (void) mprotect (region, region_size, PROT_READ);
+
+  /*
+   * Publish the new table and region, then free the old region.
+   */
+  void *old_region = MPIR_shim_proctable_region;
+  const size_t old_region_size = MPIR_shim_proctable_region_size;
+  MPIR_proctable = table;
+  MPIR_proctable_size = nprocs;
+  MPIR_shim_proctable_region = region;
+  MPIR_shim_proctable_region_size = region_size;
+  if (old_region)
+    munmap (old_region, old_region_size);
+
+  debug_printf ("Packed %lu proc table entries and %lu bytes of strings "
+		"into a %lu byte region at %p\n",
+		(unsigned long) nprocs,
+		(unsigned long) strings_size,
+		(unsigned long) region_size,
+		region);
+  return true;
+}  /* pack_proctable_region */
+
+/**********************************************************************/
+/* Build MPIR_shim_hosttable from the published MPIR_proctable, in one
+ * pass over the interned host ids, so no host names are compared.
+ */
+
+static void
+publish_host_table()
+{
+  NOTE_ENTRY_EXIT();
+
+  static std::vector<MPIR_SHIM_HOSTDESC> host_table;
+  host_table.clear();
+  const uint32_t *host_ids = (mpir_table.size() ? &mpir_table.host_ids.front() : 0);
+  for (int i = 0; i < MPIR_proctable_size; i++)
+    {
+      if (0 == i || host_ids[i] != host_ids[i - 1])
+	{
+	  MPIR_SHIM_HOSTDESC block;
+	  block.host_name = MPIR_proctable[i].host_name;
+	  block.first_index = i;
+	  block.num_procs = 0;
+	  block.node_id = host_ids[i];
+	  host_table.push_back (block);
+	}  /* if */
+      host_table.back().num_procs++;
+    }  /* for */
+
+  MPIR_shim_hosttable = (host_table.size() ? &host_table.front() : 0);
+  MPIR_shim_hosttable_size = host_table.size();
+  debug_printf ("Host table has %d blocks for %d procs\n",
+		MPIR_shim_hosttable_size,
+		MPIR_proctable_size);
+}  /* publish_host_table */
+
+/**********************************************************************/
+/* Build the MPIR_shim_proctable_* arrays from mpir_table. */
+
+static void
+publish_extended_arrays()
+{
+  NOTE_ENTRY_EXIT();
+
+  static std::vector<int> rank, node_id, host_rank, appnum, state, exit_code;
+  const size_t n = mpir_table.size();
+  rank.resize (n);
+  node_id.resize (n);
+  host_rank.resize (n);
+  appnum.resize (n);
+  state.resize (n);
+  exit_code.resize (n);
+
+  for (size_t i = 0; i < n; i++)
+    {
+      rank[i] = mpir_table.ranks[i];
+      node_id[i] = mpir_table.host_ids[i];
+      host_rank[i] = mpir_table.host_ranks[i];
+      appnum[i] = mpir_table.appnums[i];
+      state[i] = mpir_table.states[i];
+      exit_code[i] = mpir_table.exit_codes[i];
+    }  /* for */
+
+  MPIR_shim_proctable_rank = (n ? &rank.front() : 0);
+  MPIR_shim_proctable_node_id = (n ? &node_id.front() : 0);
+  MPIR_shim_proctable_host_rank = (n ? &host_rank.front() : 0);
+  MPIR_shim_proctable_appnum = (n ? &appnum.front() : 0);
+  MPIR_shim_proctable_state = (n ? &state.front() : 0);
+  MPIR_shim_proctable_exit_code = (n ? &exit_code.front() : 0);
+}  /* publish_extended_arrays */
+
+/**********************************************************************/
+/* Publish mpir_table as MPIR_proctable, packing it if requested, its
+ * host blocks as MPIR_shim_hosttable, and its extended arrays. */
+
+static void
+publish_proc_table()
+{
+  NOTE_ENTRY_EXIT();
+
+  if (layout_heap == proctable_layout ||
+      !pack_proctable_region (layout_huge == proctable_layout))
+    {
+      MPIR_proctable = (mpir_table.size() ? &mpir_table.procdesc.front() : 0);
+      MPIR_proctable_size = mpir_table.size();
+    }  /* if */
+  publish_host_table();
+  publish_extended_arrays();
+  if (use_debug_gate)
+    {
+      static std::vector<char> gates;
+      gates.resize (mpir_table.size(), 0);
+      MPIR_shim_debug_gates = (gates.size() ? &gates.front() : 0);
+    }  /* if */
+}  /* publish_proc_table */
+
+/**********************************************************************/
+/* Publish the current MPIR proc table and tell the debugger about it. */
+
+static void
+notify_debugger_spawned()
+{
+  {
+    scoped_phase_t phase ("publish proc table");
+    publish_proc_table();
+  }
+  if (MPIR_DEBUG_SPAWNED != MPIR_debug_state)
+    {
+      const double now = get_seconds();
+      phase_times.record ("start to MPIR_Breakpoint", now, now);
+      phase_times.report();
+    }  /* if */
+  MPIR_debug_state = MPIR_DEBUG_SPAWNED;
+  MPIR_Breakpoint();
+				/* The debugger may have kept us a while */
+  launch_state.restart();
+}  /* notify_debugger_spawned */
+
+/**********************************************************************/
+/* Append a PMIX_QUERY_PROC_TABLE or PMIX_QUERY_LOCAL_PROC_TABLE reply
+ * to the proc_table_t in the query data (usually mpir_table).  This is
+ * called from the query callback, so it works directly on the data
+ * array owned by the PMIx library; nothing is copied except into the
+ * proc table and the shared string tables.  If hostname_ is not NULL,
+ * the reply is for that node, and procs on other nodes are dropped.
+ */
+
+static std::string
+append_proc_table_info (proc_table_t *table_, const pmix_info_t &info_,
+			const char *hostname_ = NULL)
+{
+  /*
+   * Check the data type (which should be a data array).
+   */
+  if (PMIX_DATA_ARRAY != info_.value.type)
+    return form_string ("PMIx proc table has incorrect data type: %s (%d)",
+			PMIx_Data_type_string (info_.value.type),
+			(int) info_.value.type);
+  const pmix_data_array_t *darray = info_.value.data.darray;
+  if (NULL == darray || NULL == darray->array)
+    return "PMIx proc table data array is null";
+  if (PMIX_PROC_INFO != darray->type)
+    return form_string ("PMIx proc table data array has incorrect type: %s (%d)",
+			PMIx_Data_type_string (darray->type),
+			(int) darray->type);
+
+  /*
+   * The data array consists of a struct:
+   *     size_t size;
+   *     void* array;
+   *
+   * In this case, the array is composed of pmix_proc_info_t structs:
+   *     pmix_proc_t proc;   // contains the nspace,rank of this proc
+   *     char* hostname;
+   *     char* executable_name;
+   *     pid_t pid;
+   *     int exit_code;
+   *     pmix_proc_state_t state;
+   */
+  const size_t nprocs = darray->size;
+  const pmix_proc_info_t *proc_info = (const pmix_proc_info_t *) darray->array;
+  if (debug_output)
+    {
+      debug_printf ("Received PMIx proc table for %lu procs:\n",
+		    (unsigned long) nprocs);
+      for (int i = 0; i < nprocs; i++)
+	{
 	  const pmix_proc_info_t *p = proc_info + i;
 	  debug_printf ("proc_table[%d]: rank=%d, hostname='%s', "
 			"executable_name='%s', pid=%d, exit_code=%d, "
@@ -1289,42 +3907,962 @@ pmix_proc_table_to_mpir (const char *app_nspace_)
 			p->exit_code,
 			PMIx_Proc_state_string(p->state));
 	}  /* for */
-    }  /* if */
+    }  /* if */
+
+  /*
+   * Add the procs to the MPIR data structures.
+   */
+  if (NULL == hostname_)
+    {
+      table_->append (proc_info, nprocs);
+      return std::string();
+    }  /* if */
+  for (size_t i = 0; i < nprocs; i++)
+    if (NULL == proc_info[i].hostname ||
+	0 != strcmp (proc_info[i].hostname, hostname_))
+      return form_string ("The local proc table for node '%s' has procs on "
+			  "other nodes, so the server ignores the node",
+			  hostname_);
+  table_->append (proc_info, nprocs);
+  return std::string();
+}  /* append_proc_table_info */
+
+/* A local proc table query: the node it's for, and the table its
+ * reply is appended to. */
+
+struct node_query_t
+{
+  proc_table_t *table;
+  std::string hostname;
+};  /* node_query_t */
+
+static std::string
+proc_table_query_fn (query_data_t *query_data_,
+		     const pmix_info_t info_[], size_t ninfo_)
+{
+  NOTE_ENTRY_EXIT();
+
+  if (NULL == info_ || 0 == ninfo_)
+    return "PMIx proc table info/ninfo is 0";
+  const node_query_t *node_query = (const node_query_t *) query_data_->process_data;
+  return append_proc_table_info (node_query->table, info_[0],
+				 node_query->hostname.c_str());
+}  /* proc_table_query_fn */
+
+/**********************************************************************/
+/* What we know about a namespace besides its proc table.  It comes
+ * back in the same query as the proc table, so knowing it costs no
+ * extra round trip.  Zero or empty means the server didn't say.
+ */
+
+struct job_info_t
+{
+  uint32_t size;			/* PMIX_JOB_SIZE */
+  uint32_t num_nodes;			/* PMIX_NUM_NODES */
+  uint32_t num_apps;			/* PMIX_JOB_NUM_APPS */
+  std::vector<std::string> nodes;	/* PMIX_NODE_LIST */
+
+  job_info_t() : size (0), num_nodes (0), num_apps (0) {}
+
+  /* Save info_ if it's one of ours.  Returns false if it isn't. */
+  bool parse (const pmix_info_t &info_)
+    {
+      if (PMIX_CHECK_KEY (&info_, PMIX_NODE_LIST))
+	{
+	  if (PMIX_STRING != info_.value.type || NULL == info_.value.data.string)
+	    return true;
+				/* A comma-delimited list of nodes */
+	  const char *list = info_.value.data.string;
+	  while (*list)
+	    {
+	      const char *comma = strchr (list, ',');
+	      const size_t len = (comma ? comma - list : strlen (list));
+	      if (len)
+		nodes.push_back (std::string (list, len));
+	      list += len + (comma ? 1 : 0);
+	    }  /* while */
+	  return true;
+	}  /* if */
+      uint32_t *field = (PMIX_CHECK_KEY (&info_, PMIX_JOB_SIZE) ? &size
+			 : PMIX_CHECK_KEY (&info_, PMIX_NUM_NODES) ? &num_nodes
+			 : PMIX_CHECK_KEY (&info_, PMIX_JOB_NUM_APPS) ? &num_apps
+			 : NULL);
+      if (NULL == field)
+	return false;
+      if (PMIX_UINT32 == info_.value.type)
+	*field = info_.value.data.uint32;
+      return true;
+    }  /* parse */
+};  /* job_info_t */
+
+/* The process_data of a job query. */
+
+struct job_query_t
+{
+  proc_table_t *table;			/* NULL if not querying the proc table */
+  job_info_t *job;
+  bool have_proc_table;
+};  /* job_query_t */
+
+/* Sort a job query reply into the proc table and job info in one pass,
+ * in the query callback. */
+
+static std::string
+job_query_fn (query_data_t *query_data_,
+	      const pmix_info_t info_[], size_t ninfo_)
+{
+  NOTE_ENTRY_EXIT();
+
+  job_query_t *job_query = (job_query_t *) query_data_->process_data;
+  for (size_t n = 0; n < ninfo_; n++)
+    {
+      if (NULL != job_query->table &&
+	  PMIX_CHECK_KEY (&info_[n], PMIX_QUERY_PROC_TABLE))
+	{
+	  const std::string error =
+	    append_proc_table_info (job_query->table, info_[n]);
+	  if (!error.empty())
+	    return error;
+	  job_query->have_proc_table = true;
+	}  /* if */
+      else if (!job_query->job->parse (info_[n]))
+	debug_printf ("Ignoring unexpected job query key '%s'\n",
+		      info_[n].key);
+    }  /* for */
+  return std::string();
+}  /* job_query_fn */
+
+/* Query the job information of the given namespace (unless
+ * with_job_info_ is false), and if table_ isn't NULL, its whole proc
+ * table, all in one request.  The proc table is answered by a single
+ * server after it has gathered it, and is appended to table_.
+ * Returns false, after saying why, if the server couldn't answer;
+ * missing job info isn't an error. */
+
+static bool
+query_job (const char *app_nspace_, proc_table_t *table_, job_info_t *job_,
+	   bool with_job_info_ = true)
+{
+  NOTE_ENTRY_EXIT();
+
+  pmix::status_t rc;
+  pmix::query_t query;
+  if (NULL != table_)
+    PMIX_ARGV_APPEND (rc, query.keys, PMIX_QUERY_PROC_TABLE);
+  if (with_job_info_)
+    {
+      PMIX_ARGV_APPEND (rc, query.keys, PMIX_JOB_SIZE);
+      PMIX_ARGV_APPEND (rc, query.keys, PMIX_NUM_NODES);
+      PMIX_ARGV_APPEND (rc, query.keys, PMIX_JOB_NUM_APPS);
+      PMIX_ARGV_APPEND (rc, query.keys, PMIX_NODE_LIST);
+    }  /* if */
+  query.qualifiers = new pmix::info_t (PMIX_NSPACE, app_nspace_);
+  query.nqual = 1;
+  job_query_t job_query = { table_, job_, false };
+  query_data_t query_data;
+  query_data.process_fn = job_query_fn;
+  query_data.process_data = &job_query;
+  rc = PMIx_Query_info_nb (&query, 1, query_callback_fn, (void *) &query_data);
+  if (PMIX_SUCCESS != rc)
+    {
+      debug_printf ("Job PMIx_Query_info_nb() failed: %s\n",
+		    PMIx_Error_string (rc));
+      return false;
+    }  /* if */
+  debug_printf ("Waiting for job query response\n");
+  launch_state.wait (query_data.latch);
+  debug_printf ("Job query response received: size %u, %u node(s) "
+		"(%lu listed), %u app(s)\n",
+		(unsigned int) job_->size,
+		(unsigned int) job_->num_nodes,
+		(unsigned long) job_->nodes.size(),
+		(unsigned int) job_->num_apps);
+
+  if (PMIX_SUCCESS != query_data.status && !is_partial_success (query_data.status))
+    {
+      debug_printf ("Job query status error: %s\n",
+		    PMIx_Error_string (query_data.status));
+      return false;
+    }  /* if */
+  if (!query_data.process_error.empty())
+    pmix_fatal_error (PMIX_SUCCESS, "%s", query_data.process_error.c_str());
+  if (NULL != table_ && !job_query.have_proc_table)
+    {
+      debug_printf ("Job query reply has no proc table\n");
+      return false;
+    }  /* if */
+  return true;
+}  /* query_job */
+
+/**********************************************************************/
+/* Get the first rank (the "app leader") of each application in the
+ * namespace.  The ranks of an application are contiguous, so these
+ * are enough to map any rank to its application number.  Returns an
+ * empty vector if there is only one application or the leaders are
+ * not available.
+ */
+
+static std::vector<pmix::rank_t>
+get_app_leaders (const char *app_nspace_, uint32_t napps_)
+{
+  NOTE_ENTRY_EXIT();
+
+  std::vector<pmix::rank_t> leaders;
+  pmix::proc_t wildcard (app_nspace_, PMIX_RANK_WILDCARD);
+  pmix_value_t *value = NULL;
+  pmix::status_t rc;
+				/* If the job query didn't say, ask */
+  if (0 == napps_)
+    {
+      rc = PMIx_Get (&wildcard, PMIX_JOB_NUM_APPS, NULL, 0, &value);
+      if (PMIX_SUCCESS != rc || NULL == value)
+	{
+	  debug_printf ("Getting PMIX_JOB_NUM_APPS failed: %s\n",
+			PMIx_Error_string (rc));
+	  return leaders;
+	}  /* if */
+      napps_ = (PMIX_UINT32 == value->type ? value->data.uint32 : 1);
+      PMIX_VALUE_RELEASE (value);
+    }  /* if */
+  const uint32_t napps = napps_;
+  if (napps < 2)
+    return leaders;
+
+  for (uint32_t app = 0; app < napps; app++)
+    {
+      pmix::info_t qualifiers[2];
+      qualifiers[0].load (PMIX_APP_INFO, true);
+      qualifiers[1].load (PMIX_APPNUM, app);
+      value = NULL;
+      rc = PMIx_Get (&wildcard, PMIX_APPLDR, qualifiers, 2, &value);
+      if (PMIX_SUCCESS != rc || NULL == value || PMIX_PROC_RANK != value->type)
+	{
+	  debug_printf ("Getting PMIX_APPLDR of app %u failed: %s\n",
+			(unsigned int) app,
+			PMIx_Error_string (rc));
+	  if (NULL != value)
+	    PMIX_VALUE_RELEASE (value);
+	  leaders.clear();
+	  return leaders;
+	}  /* if */
+      leaders.push_back (value->data.rank);
+      PMIX_VALUE_RELEASE (value);
+    }  /* for */
+  debug_printf ("Namespace '%s' has %u applications\n",
+		app_nspace_,
+		(unsigned int) napps);
+  return leaders;
+}  /* get_app_leaders */
+
+/**********************************************************************/
+/* Query the whole proc table of the namespace, along with its job
+ * info, in one request, and append it to table_. */
+
+static void
+query_proc_table_global (const char *app_nspace_, proc_table_t *table_,
+			 job_info_t *job_)
+{
+  NOTE_ENTRY_EXIT();
+
+  /*
+   * A server that rejects the whole query over a key it doesn't know
+   * still gets asked for just the proc table.
+   */
+  if (!query_job (app_nspace_, table_, job_) &&
+      !query_job (app_nspace_, table_, job_, false))
+    pmix_fatal_error (PMIX_ERROR, "PMIx proc table query failed");
+}  /* query_proc_table_global */
+
+/**********************************************************************/
+/* Whether the server answers a local proc table query for the node
+ * named with PMIX_HOSTNAME.  PMIx only documents the query for the
+ * server's own node, so the first per-node query finds out. */
+
+enum local_proc_table_support_t
+{
+  lpt_unknown,
+  lpt_supported,
+  lpt_unsupported
+};
+static local_proc_table_support_t local_proc_table_support = lpt_unknown;
+
+/* Issue a local proc table query for each of nodes_, all in flight at
+ * once, and wait for all of them.  Each reply is appended to table_ by
+ * the query callback as it arrives, so a slow node doesn't hold up
+ * the others.  Returns the first error, or an empty string. */
+
+static std::string
+query_local_proc_tables (const char *app_nspace_, proc_table_t *table_,
+			 const std::vector<std::string> &nodes_)
+{
+  NOTE_ENTRY_EXIT();
+
+  /*
+   * Issue all of the queries.  The query objects must stay around
+   * until their callbacks have been called.
+   */
+  const size_t nnodes = nodes_.size();
+  std::vector<pmix::query_t *> queries (nnodes);
+  std::vector<query_data_t *> query_data (nnodes);
+  std::vector<node_query_t> node_queries (nnodes);
+  std::string error;
+  for (size_t n = 0; n < nnodes; n++)
+    {
+      pmix::status_t rc;
+      node_queries[n].table = table_;
+      node_queries[n].hostname = nodes_[n];
+      queries[n] = new pmix::query_t;
+      PMIX_ARGV_APPEND (rc, queries[n]->keys, PMIX_QUERY_LOCAL_PROC_TABLE);
+      PMIX_INFO_CREATE (queries[n]->qualifiers, 2);
+      queries[n]->nqual = 2;
+      PMIX_INFO_LOAD (&queries[n]->qualifiers[0], PMIX_NSPACE, app_nspace_, PMIX_STRING);
+      PMIX_INFO_LOAD (&queries[n]->qualifiers[1], PMIX_HOSTNAME, nodes_[n].c_str(), PMIX_STRING);
+      query_data[n] = new query_data_t;
+      query_data[n]->process_fn = proc_table_query_fn;
+      query_data[n]->process_data = &node_queries[n];
+      rc = PMIx_Query_info_nb (queries[n], 1, query_callback_fn, (void *) query_data[n]);
+      if (PMIX_SUCCESS != rc)
+	{
+				/* No callback is coming */
+	  error = form_string ("PMIx_Query_info_nb() failed for node '%s': %s",
+			       nodes_[n].c_str(),
+			       PMIx_Error_string (rc));
+	  delete query_data[n];
+	  delete queries[n];
+	  query_data.resize (n);
+	  break;
+	}  /* if */
+    }  /* for */
+
+  /*
+   * Wait for all of the responses.  The total wait is only as long as
+   * the slowest node.
+   */
+  debug_printf ("Waiting for %lu local proc table query responses\n",
+		(unsigned long) query_data.size());
+  for (size_t n = 0; n < query_data.size(); n++)
+    {
+      launch_state.wait (query_data[n]->latch);
+      if (error.empty() && PMIX_SUCCESS != query_data[n]->status)
+	error = form_string ("PMIx local proc table status error for node '%s': %s",
+			     nodes_[n].c_str(),
+			     PMIx_Error_string (query_data[n]->status));
+      if (error.empty() && !query_data[n]->process_error.empty())
+	error = query_data[n]->process_error;
+      delete query_data[n];
+      delete queries[n];
+    }  /* for */
+  debug_printf ("Local proc table query responses received\n");
+  return error;
+}  /* query_local_proc_tables */
+
+/* Take the entries from base_ on back out of table_. */
+
+static void
+truncate_proc_table (proc_table_t *table_, size_t base_)
+{
+  std::vector<size_t> from (base_);
+  for (size_t i = 0; i < base_; i++)
+    from[i] = i;
+  table_->permute (from);
+}  /* truncate_proc_table */
+
+/**********************************************************************/
+/* Query the proc table one node at a time, with the local proc table
+ * queries in flight at once.  Only each node's own procs may be in
+ * its reply, and a rank that shows up twice is only kept once.  The
+ * first query is for one node on its own, which tells us whether the
+ * server answers for the node it's asked about; if it doesn't, and
+ * whenever the node list isn't available or a node's query fails,
+ * we fall back to a global query. */
+
+static void
+query_proc_table_per_node (const char *app_nspace_, proc_table_t *table_,
+			   job_info_t *job_)
+{
+  NOTE_ENTRY_EXIT();
+
+				/* The job info has the node list */
+  query_job (app_nspace_, NULL, job_);
+  std::vector<std::string> nodes = job_->nodes;
+  if (nodes.empty() || lpt_unsupported == local_proc_table_support)
+    {
+      debug_printf ("%s, using a global proc table query\n",
+		    (nodes.empty()
+		     ? "No node list"
+		     : "No local proc tables for other nodes"));
+      query_proc_table_global (app_nspace_, table_, job_);
+      return;
+    }  /* if */
+
+  const size_t base = table_->size();
+  std::string error;
+  if (lpt_unknown == local_proc_table_support)
+    {
+      /*
+       * Probe with a node other than ours, if there is one, since our
+       * node's local proc table is right even if the node is ignored.
+       */
+      char host[256];
+      if (0 != gethostname (host, sizeof (host)))
+	host[0] = '\0';
+      host[sizeof (host) - 1] = '\0';
+      size_t probe = 0;
+      while (probe + 1 < nodes.size() && nodes[probe] == host)
+	probe++;
+      error = query_local_proc_tables (app_nspace_, table_,
+				       std::vector<std::string> (1, nodes[probe]));
+      if (error.empty() && table_->size() == base)
+	error = form_string ("The local proc table for node '%s' is empty",
+			     nodes[probe].c_str());
+      local_proc_table_support = (error.empty() ? lpt_supported : lpt_unsupported);
+      debug_printf ("Local proc tables for other nodes are %ssupported\n",
+		    error.empty() ? "" : "not ");
+      nodes.erase (nodes.begin() + probe);
+    }  /* if */
+  if (error.empty())
+    error = query_local_proc_tables (app_nspace_, table_, nodes);
+
+  /*
+   * Keep the first entry for each rank.
+   */
+  std::vector<size_t> from;
+  from.reserve (table_->size());
+  for (size_t i = 0; i < base; i++)
+    from.push_back (i);
+  std::vector<pmix::rank_t> seen (table_->ranks.begin() + base,
+				  table_->ranks.end());
+  std::sort (seen.begin(), seen.end());
+  seen.erase (std::unique (seen.begin(), seen.end()), seen.end());
+  std::vector<char> kept (seen.size(), 0);
+  for (size_t i = base; i < table_->size(); i++)
+    {
+      const size_t k = (std::lower_bound (seen.begin(), seen.end(), table_->ranks[i])
+			- seen.begin());
+      if (!kept[k])
+	{
+	  kept[k] = 1;
+	  from.push_back (i);
+	}  /* if */
+    }  /* for */
+  if (from.size() < table_->size())
+    {
+      debug_printf ("Dropped %lu duplicate ranks from the local proc tables\n",
+		    (unsigned long) (table_->size() - from.size()));
+      table_->permute (from);
+    }  /* if */
+
+  /*
+   * If a node's query failed, or the nodes didn't account for the
+   * whole job, start over with a global query.
+   */
+  if (error.empty() && 0 != job_->size && table_->size() - base != job_->size)
+    error = form_string ("The local proc tables have %lu procs, the job has %lu",
+			 (unsigned long) (table_->size() - base),
+			 (unsigned long) job_->size);
+  if (!error.empty())
+    {
+      debug_printf ("%s, using a global proc table query\n", error.c_str());
+      truncate_proc_table (table_, base);
+      query_proc_table_global (app_nspace_, table_, job_);
+    }  /* if */
+}  /* query_proc_table_per_node */
+
+/**********************************************************************/
+/* Query the proc table of the namespace the way the user asked for,
+ * and append it to table_. */
+
+static void
+query_proc_table (const char *app_nspace_, proc_table_t *table_)
+{
+  const size_t base = table_->size();
+  const double start = get_seconds();
+  job_info_t job;
+  if (proctable_query_per_node)
+    query_proc_table_per_node (app_nspace_, table_, &job);
+  else
+    query_proc_table_global (app_nspace_, table_, &job);
+  const double end = get_seconds();
+  phase_times.record ("proc table query", start, end);
+  debug_printf ("Proc table query (%s) took %.6f seconds\n",
+		proctable_query_per_node ? "per-node" : "global",
+		end - start);
+
+  /*
+   * Number the new entries on each host in rank order, which is how
+   * PMIx assigns local ranks by default.  We don't query
+   * PMIX_LOCAL_RANK (one PMIx_Get() per process), so under other
+   * rankings this may not match it.  Visit them in rank order by
+   * placing them directly, if the ranks are dense.
+   */
+  const size_t count = table_->size() - base;
+  if (0 != job.size && count != job.size)
+    debug_printf ("Proc table has %lu procs, but the job size is %u\n",
+		  (unsigned long) count,
+		  (unsigned int) job.size);
+  std::vector<size_t> by_rank (count, count);
+  bool dense = true;
+  for (size_t k = 0; k < count && dense; k++)
+    {
+      const pmix::rank_t r = table_->ranks[base + k];
+      dense = (r < count && by_rank[r] == count);
+      if (dense)
+	by_rank[r] = k;
+    }  /* for */
+  std::vector<int> next_host_rank (mpir_hostnames.size(), 0);
+  for (size_t k = 0; k < count; k++)
+    {
+      const size_t i = base + (dense ? by_rank[k] : k);
+      table_->host_ranks[i] = next_host_rank[table_->host_ids[i]]++;
+    }  /* for */
+
+  /*
+   * Fill in the application numbers of the new entries.
+   */
+  const std::vector<pmix::rank_t> leaders = get_app_leaders (app_nspace_, job.num_apps);
+  if (!leaders.empty())
+    for (size_t i = base; i < table_->size(); i++)
+      {
+	uint32_t app = 0;
+	for (uint32_t a = 0; a < leaders.size(); a++)
+	  if (leaders[a] <= table_->ranks[i] &&
+	      leaders[a] >= leaders[app])
+	    app = a;
+	table_->appnums[i] = app;
+      }  /* for */
+}  /* query_proc_table */
+
+/**********************************************************************/
+/* Release the ranks_ of the namespace from PMIX_DEBUG_STOP_IN_INIT (or
+ * whatever else is holding them for the debugger), with one targeted
+ * PMIX_ERR_DEBUGGER_RELEASE event.  Use PMIX_RANK_WILDCARD to release
+ * the whole namespace.
+ */
+
+static void
+release_procs (const char *app_nspace_, const std::vector<pmix::rank_t> &ranks_)
+{
+  NOTE_ENTRY_EXIT();
+
+  if (ranks_.empty())
+    return;
+
+  std::vector<pmix::proc_t> procs (ranks_.size());
+  for (size_t n = 0; n < ranks_.size(); n++)
+    procs[n].load (app_nspace_, ranks_[n]);
+  pmix_data_array_t targets;
+  targets.type = PMIX_PROC;
+  targets.size = procs.size();
+  targets.array = &procs.front();
+
+  DEFINE_INFO();
+				/* Deliver to the target procs */
+  if (1 == procs.size())
+    INFO_NEXT.load (PMIX_EVENT_CUSTOM_RANGE, &procs.front(), PMIX_PROC);
+  else
+    INFO_NEXT.load (PMIX_EVENT_CUSTOM_RANGE, &targets, PMIX_DATA_ARRAY);
+  INFO_NEXT.load (PMIX_EVENT_NON_DEFAULT, true);
+
+  debug_printf ("Sending debugger release to %lu proc(s)\n",
+		(unsigned long) procs.size());
+  pmix::status_t rc =
+    PMIx_Notify_event (PMIX_ERR_DEBUGGER_RELEASE,
+		       NULL, PMIX_RANGE_CUSTOM,
+		       &info.front(), info.size(),
+		       NULL, NULL);
+  if (PMIX_SUCCESS != rc)
+    pmix_fatal_error (rc, "PMIx_Notify_event() failed sending PMIX_ERR_DEBUGGER_RELEASE");
+}  /* release_procs */
+
+/**********************************************************************/
+/* Extract the PMIx proc table and use it to fill-in the MPIR proc
+ * table.  Then, call MPIR_Breakpoint() to notify the debugger that is
+ * debugging this process.
+ */
+
+static void
+pmix_proc_table_to_mpir (const char *app_nspace_)
+{
+  NOTE_ENTRY_EXIT();
+
+  query_proc_table (app_nspace_, &mpir_table);
+
+  /*
+   * Put the proc table in the requested order while it still holds
+   * the whole job, so ordering by rank is a direct placement.
+   */
+  mpir_table.order();
+
+  /*
+   * If only some procs are to be debugged, drop the rest from the
+   * proc table and let them run now.  This keeps the order.
+   */
+  if (attach_selector.active())
+    {
+      std::vector<pmix::rank_t> unselected;
+      mpir_table.select (&unselected);
+      debug_printf ("Attaching to %lu procs, releasing %lu\n",
+		    (unsigned long) mpir_table.size(),
+		    (unsigned long) unselected.size());
+      release_procs (app_nspace_, unselected);
+    }  /* if */
+
+  /*
+   * Publish the MPIR proc table and notify the debugger.
+   */
+  notify_debugger_spawned();
+}  /* pmix_proc_table_to_mpir */
+
+/**********************************************************************/
+/* Return the namespace of the job that spawned nspace_, or an empty
+ * string if the server doesn't say. */
+
+static std::string
+get_parent_nspace (const char *nspace_)
+{
+  pmix::proc_t wildcard (nspace_, PMIX_RANK_WILDCARD);
+  pmix_value_t *value = NULL;
+  pmix::status_t rc = PMIx_Get (&wildcard, PMIX_PARENT_ID, NULL, 0, &value);
+  std::string parent;
+  if (PMIX_SUCCESS == rc && NULL != value && PMIX_PROC == value->type)
+    parent = value->data.proc->nspace;
+  else
+    debug_printf ("Getting PMIX_PARENT_ID of namespace '%s' failed: %s\n",
+		  nspace_,
+		  PMIx_Error_string (rc));
+  if (NULL != value)
+    PMIX_VALUE_RELEASE (value);
+  return parent;
+}  /* get_parent_nspace */
+
+/**********************************************************************/
+/* Streaming support: a snapshot of the proc table, indexed by rank,
+ * that ready ranks are copied out of as they report in. */
+
+struct stream_snapshot_t
+{
+  proc_table_t table;
+  std::vector<size_t> index;		/* Rank to table entry, or ~0 */
+
+  /* Query a fresh snapshot of the namespace's proc table. */
+  void refresh (const char *nspace_)
+    {
+      table.clear();
+      query_proc_table (nspace_, &table);
+      index.assign (index.size(), ~size_t(0));
+      for (size_t i = 0; i < table.size(); i++)
+	{
+	  const pmix::rank_t rank = table.ranks[i];
+	  if (rank >= index.size())
+	    index.resize (rank + 1, ~size_t(0));
+	  index[rank] = i;
+	}  /* for */
+    }  /* refresh */
+
+  /* The table entry for a rank, or ~0 if it's not known yet. */
+  size_t find (pmix::rank_t rank_) const
+    {
+      if (rank_ >= index.size() ||
+	  ~size_t(0) == index[rank_] ||
+	  0 >= table.procdesc[index[rank_]].pid)
+	return ~size_t(0);
+      return index[rank_];
+    }  /* find */
+};  /* stream_snapshot_t */
+
+/**********************************************************************/
+/* Stream the proc table to the debugger while the launch is still in
+ * progress.  Ranks are appended to MPIR_proctable in the order that
+ * they report PMIX_READY_FOR_DEBUG, and each batch is announced with
+ * one MPIR_DEBUG_SPAWNED breakpoint, which MPIR allows because we
+ * define MPIR_partial_attach_ok.  The batch size doubles each time, so
+ * the number of breakpoints (and proc table queries) only grows with
+ * the log of the job size.  A batch is also sent early if no more
+ * ranks report in for a little while.  When the launch completes, the
+ * remaining ranks are published in the order selected with
+ * "--proctable-order".
+ *
+ * Until then we don't know the application's namespace, so we take it
+ * to be the first one that reports in whose parent is our launcher,
+ * and ignore the others: on a shared server they may be other users'
+ * jobs.  If the server doesn't say who the parent is, nothing is
+ * streamed, and everything is published when the launch completes.
+ *
+ * Note that in this mode MPIR_proctable is in report-in order, not
+ * rank order.
+ */
+
+static void
+stream_proc_table_to_mpir (stream_t *stream_)
+{
+  NOTE_ENTRY_EXIT();
+
+  const long flush_nsec = 100 * 1000 * 1000;	/* Send a partial batch after 100ms */
+  size_t batch = proctable_stream_batch;
+  stream_snapshot_t snapshot;
+  std::vector<bool> published;		/* Indexed by rank */
+  std::vector<pmix::rank_t> deferred;	/* Ready, but not in the snapshot yet */
+  std::string nspace;			/* The application's, once known */
+  std::vector<std::string> ignored;	/* Namespaces that aren't */
+
+  for (;;)
+    {
+      /*
+       * Wait for a full batch, a quiet period, or the end of the launch.
+       */
+      std::vector<ready_proc_t> ready_procs;
+      bool done;
+      pthread_mutex_lock (&stream_->mutex);
+      while (stream_->ready.size() + deferred.size() < batch &&
+	     !stream_->launch_complete &&
+	     !stream_->all_ready)
+	{
+	  struct timespec deadline;
+	  clock_gettime (CLOCK_REALTIME, &deadline);
+	  deadline.tv_nsec += flush_nsec;
+	  if (deadline.tv_nsec >= 1000000000L)
+	    {
+	      deadline.tv_sec += 1;
+	      deadline.tv_nsec -= 1000000000L;
+	    }  /* if */
+	  if (ETIMEDOUT == pthread_cond_timedwait (&stream_->cond,
+						   &stream_->mutex,
+						   &deadline) &&
+	      !stream_->ready.empty())
+	    break;
+				/* Don't hold up the event handlers if it aborts */
+	  pthread_mutex_unlock (&stream_->mutex);
+	  launch_state.check();
+	  pthread_mutex_lock (&stream_->mutex);
+	}  /* while */
+      ready_procs.swap (stream_->ready);
+      stream_->all_ready = false;
+      done = stream_->launch_complete;
+      if (done)
+	nspace = stream_->nspace;
+      pthread_mutex_unlock (&stream_->mutex);
+      if (done)
+	break;
+
+      /*
+       * Keep the application's ranks, finding out which namespace that
+       * is if we don't know yet.
+       */
+      std::vector<pmix::rank_t> ready;
+      for (size_t n = 0; n < ready_procs.size() && !done; n++)
+	{
+	  const std::string &proc_nspace = ready_procs[n].first;
+	  if (nspace.empty() &&
+	      ignored.end() == std::find (ignored.begin(), ignored.end(), proc_nspace))
+	    {
+	      if (launch_state.launcher_nspace == get_parent_nspace (proc_nspace.c_str()))
+		nspace = proc_nspace;
+	      else
+		{
+		  debug_printf ("Not streaming namespace '%s', which our launcher "
+				"didn't start\n", proc_nspace.c_str());
+		  ignored.push_back (proc_nspace);
+		}  /* else */
+	    }  /* if */
+	  if (nspace != proc_nspace)
+	    continue;
+	  if (PMIX_RANK_WILDCARD == ready_procs[n].second)
+	    done = true;
+	  else
+	    ready.push_back (ready_procs[n].second);
+	}  /* for */
+      if (done)
+	break;
 
-  /*
-   * Create the MPIR data structures.
-   *
-   */
-  MPIR_proctable = new MPIR_PROCDESC[nprocs];
-  MPIR_proctable_size = nprocs;
-  for (int i = 0; i < nprocs; i++)
-    {
-      const pmix_proc_info_t *p = proc_info + i;
-      std::pair <std::set<std::string>::iterator,bool> host_res =
-	mpir_hostnames.insert (std::string (p->hostname));
-      std::pair <std::set<std::string>::iterator,bool> exec_res =
-	mpir_executables.insert (std::string (p->executable_name));
-      MPIR_proctable[i].host_name = host_res.first->c_str();
-      MPIR_proctable[i].executable_name = exec_res.first->c_str();
-      MPIR_proctable[i].pid = p->pid;
+      /*
+       * Copy the ready ranks into the MPIR proc table, refreshing the
+       * snapshot (at most once per batch) if it doesn't know them.
+       */
+      ready.insert (ready.end(), deferred.begin(), deferred.end());
+      deferred.clear();
+      bool refreshed = false;
+      const size_t before = mpir_table.size();
+      std::vector<pmix::rank_t> unselected;
+      for (size_t n = 0; n < ready.size(); n++)
+	{
+	  const pmix::rank_t rank = ready[n];
+	  if (rank < published.size() && published[rank])
+	    continue;
+	  size_t i = snapshot.find (rank);
+	  if (~size_t(0) == i && !refreshed)
+	    {
+	      snapshot.refresh (nspace.c_str());
+	      refreshed = true;
+	      i = snapshot.find (rank);
+	    }  /* if */
+	  if (~size_t(0) == i)
+	    {
+	      deferred.push_back (rank);
+	      continue;
+	    }  /* if */
+	  if (attach_selector.selects (rank, snapshot.table.host_ids[i]))
+	    mpir_table.append_entry (snapshot.table, i);
+	  else
+	    unselected.push_back (rank);
+	  if (rank >= published.size())
+	    published.resize (rank + 1, false);
+	  published[rank] = true;
+	}  /* for */
+      release_procs (nspace.c_str(), unselected);
+
+      if (mpir_table.size() > before)
+	{
+	  debug_printf ("Streaming %lu more procs to the debugger, %lu total\n",
+			(unsigned long) (mpir_table.size() - before),
+			(unsigned long) mpir_table.size());
+	  notify_debugger_spawned();
+	  batch *= 2;
+	}  /* if */
     }  /* for */
-  MPIR_debug_state = MPIR_DEBUG_SPAWNED;
 
   /*
-   * Notify the debugger.
+   * The launch is complete, so publish everything that is left, in
+   * the requested order.
    */
-  MPIR_Breakpoint();
-}  /* pmix_proc_table_to_mpir */
+  snapshot.refresh (nspace.c_str());
+  snapshot.table.order();
+  const size_t before = mpir_table.size();
+  std::vector<pmix::rank_t> unselected;
+  for (size_t i = 0; i < snapshot.table.size(); i++)
+    {
+      const pmix::rank_t rank = snapshot.table.ranks[i];
+      if (rank < published.size() && published[rank])
+	continue;
+      if (attach_selector.selects (rank, snapshot.table.host_ids[i]))
+	mpir_table.append_entry (snapshot.table, i);
+      else
+	unselected.push_back (rank);
+    }  /* for */
+  release_procs (nspace.c_str(), unselected);
+  debug_printf ("Streamed the last %lu procs to the debugger, %lu total\n",
+		(unsigned long) (mpir_table.size() - before),
+		(unsigned long) mpir_table.size());
+  notify_debugger_spawned();
+}  /* stream_proc_table_to_mpir */
 
 /**********************************************************************/
-/* Setup the session temp directory name and rendezvous filename. */
+/* Add the child jobs that the application spawns to the MPIR proc
+ * table until the launcher terminates.  Each child is appended after
+ * the existing entries, which are never moved or rebuilt (apart from
+ * being copied when MPIR_proctable has to grow, which std::vector
+ * amortizes), and all of the children that arrived together are
+ * announced with a single MPIR_DEBUG_SPAWNED breakpoint.
+ */
 
 static void
+follow_child_jobs (child_jobs_t *children_)
+{
+  NOTE_ENTRY_EXIT();
+
+  for (;;)
+    {
+      std::vector<child_job_t> nspaces;
+      pthread_mutex_lock (&children_->mutex);
+      while (children_->pending.empty() && !children_->done)
+	{
+				/* Wake up now and then to check the deadline */
+	  struct timespec deadline;
+	  clock_gettime (CLOCK_REALTIME, &deadline);
+	  deadline.tv_sec += 1;
+	  if (ETIMEDOUT == pthread_cond_timedwait (&children_->cond,
+						   &children_->mutex,
+						   &deadline))
+	    {
+	      pthread_mutex_unlock (&children_->mutex);
+	      launch_state.check();
+	      pthread_mutex_lock (&children_->mutex);
+	    }  /* if */
+	}  /* while */
+      nspaces.swap (children_->pending);
+      const bool done = children_->done;
+      pthread_mutex_unlock (&children_->mutex);
+
+      if (!nspaces.empty())
+	{
+	  const size_t before = mpir_table.size();
+	  size_t nchildren = 0;
+	  for (size_t n = 0; n < nspaces.size(); n++)
+	    {
+	      child_job_t &job = nspaces[n];
+	      if (job.parent.empty())
+		job.parent = get_parent_nspace (job.nspace.c_str());
+	      if (!children_->follow (job))
+		{
+		  debug_printf ("Not following job '%s', parent '%s'\n",
+				job.nspace.c_str(),
+				job.parent.c_str());
+		  continue;
+		}  /* if */
+	      proc_table_t child;
+	      query_proc_table (job.nspace.c_str(), &child);
+	      child.order();
+	      for (size_t i = 0; i < child.size(); i++)
+		mpir_table.append_entry (child, i);
+	      nchildren++;
+	    }  /* for */
+	  if (0 != nchildren)
+	    {
+	      debug_printf ("Adding %lu procs from %lu child job(s), %lu total\n",
+			    (unsigned long) (mpir_table.size() - before),
+			    (unsigned long) nchildren,
+			    (unsigned long) mpir_table.size());
+	      notify_debugger_spawned();
+	    }  /* if */
+	}  /* if */
+      if (done)
+	break;
+    }  /* for */
+}  /* follow_child_jobs */
+
+/**********************************************************************/
+/* Is dir_ a writable directory on a tmpfs file system? */
+
+static bool
+is_usable_tmpfs (const char *dir_)
+{
+  if (NULL == dir_ || '\0' == dir_[0] || 0 != access (dir_, W_OK | X_OK))
+    return false;
+#if defined(HAVE_SYS_VFS_H)
+  const long tmpfs_magic = 0x01021994;	/* TMPFS_MAGIC in <linux/magic.h> */
+  struct statfs fs;
+  return (0 == statfs (dir_, &fs) && tmpfs_magic == long (fs.f_type));
+#else
+  return false;
+#endif
+}  /* is_usable_tmpfs */
+
+/**********************************************************************/
+/* Setup the session temp directory name and rendezvous filename.
+ * Returns an error message, or an empty string on success. */
+
+static std::string
 setup_session_paths()
 {
-  const char *tmpdir = getenv("TMPDIR");
+  /*
+   * The launcher's server creates its rendezvous file and sockets in
+   * the session directory, so prefer a memory-backed (tmpfs)
+   * directory, which is fast and local even where $TMPDIR is on a
+   * network file system.
+   */
+  const char *tmpdir = NULL;
+  const char *candidates[] = {
+    getenv ("TMPDIR"),
+    getenv ("XDG_RUNTIME_DIR"),
+    "/dev/shm"
+  };
+  for (size_t n = 0; n < sizeof (candidates) / sizeof (candidates[0]) && !tmpdir; n++)
+    if (is_usable_tmpfs (candidates[n]))
+      tmpdir = candidates[n];
+  if (!tmpdir)
+    tmpdir = getenv("TMPDIR");
   if (!tmpdir || access (tmpdir, F_OK) != 0)
     tmpdir = "/tmp";
+  debug_printf ("Using '%s' for the session directory\n", tmpdir);
 
   session_dirname = form_string ("%s/%s.session.%d.%d",
 				 tmpdir,
@@ -1338,10 +4876,592 @@ setup_session_paths()
 
   int rc = mkdir (session_dirname.c_str(), S_IRWXU);
   if (0 != rc)
-    fatal_error ("mkdir() failed: %s",
-		 get_errno_string().c_str());
+    return form_string ("mkdir() failed: %s",
+			get_errno_string().c_str());
+  return std::string();
 }  /* setup_session_paths */
 
+/**********************************************************************/
+/* Exit with an error if the launcher has exited. */
+
+static void
+check_launcher_running()
+{
+  std::string how;
+  if (launcher_has_exited (how))
+    pmix_fatal_error (PMIX_SUCCESS,
+		      "The launcher exited %s before starting its PMIx server",
+		      how.c_str());
+}  /* check_launcher_running */
+
+/**********************************************************************/
+/* Wait up to timeout_ seconds for the launcher to finish writing its
+ * rendezvous file.  With inotify, we wake up as soon as the file is
+ * closed after writing (or renamed into place), instead of polling.
+ * A launcher that exits without writing it is a fatal error, reported
+ * as soon as we notice.  Returns false if the file didn't appear in
+ * time, in which case connect_to_server()'s retries are all we have.
+ */
+
+static bool
+wait_for_rendezvous_file (double timeout_)
+{
+  NOTE_ENTRY_EXIT();
+
+  const double deadline = get_seconds() + timeout_;
+  struct stat st;
+
+#if defined(HAVE_SYS_INOTIFY_H)
+  const char *slash = strrchr (rendezvous_filename.c_str(), '/');
+  const char *basename = (slash ? slash + 1 : rendezvous_filename.c_str());
+  int fd = inotify_init1 (IN_CLOEXEC | IN_NONBLOCK);
+  if (fd >= 0 &&
+      inotify_add_watch (fd, session_dirname.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) >= 0)
+    {
+      /*
+       * Check for the file after adding the watch, so we can't miss it.
+       */
+      bool found = (0 == stat (rendezvous_filename.c_str(), &st) && st.st_size > 0);
+      const int check_msec = 100;	/* For the launcher exiting */
+      while (!found)
+	{
+	  const double left = deadline - get_seconds();
+	  if (left <= 0)
+	    break;
+	  check_launcher_running();
+	  struct pollfd pfd;
+	  pfd.fd = fd;
+	  pfd.events = POLLIN;
+	  if (poll (&pfd, 1, std::min (int (left * 1000) + 1, check_msec)) <= 0)
+	    continue;
+	  char buffer[4096] __attribute__ ((aligned (__alignof__ (struct inotify_event))));
+	  ssize_t len;
+	  while ((len = read (fd, buffer, sizeof (buffer))) > 0)
+	    {
+	      for (char *p = buffer; p < buffer + len; )
+		{
+		  const struct inotify_event *event = (const struct inotify_event *) p;
+		  if (event->len > 0 && 0 == strcmp (event->name, basename))
+		    found = true;
+		  p += sizeof (struct inotify_event) + event->len;
+		}  /* for */
+	    }  /* while */
+	}  /* while */
+      close (fd);
+      debug_printf ("Rendezvous file %s\n",
+		    found ? "is ready" : "did not appear in time");
+      return found;
+    }  /* if */
+  if (fd >= 0)
+    close (fd);
+  debug_printf ("Can't watch the session directory, polling for the rendezvous file\n");
+#endif
+
+  /*
+   * Without inotify, poll for the file.
+   */
+  const useconds_t poll_usec = 10 * 1000;
+  while (get_seconds() < deadline)
+    {
+      if (0 == stat (rendezvous_filename.c_str(), &st) && st.st_size > 0)
+	return true;
+      check_launcher_running();
+      usleep (poll_usec);
+    }  /* while */
+  return false;
+}  /* wait_for_rendezvous_file */
+
+/**********************************************************************/
+/* Thread start routine that sets up the session paths, so the session
+ * directory is created while PMIx initializes.  Returns a new'd error
+ * message for the joining thread to report, or NULL on success; the
+ * helper thread must not exit the process itself. */
+
+static void *
+setup_session_paths_thread (void *)
+{
+  scoped_phase_t phase ("session directory");
+  std::string error = setup_session_paths();
+  return (error.empty() ? 0 : new std::string (error));
+}  /* setup_session_paths_thread */
+
+/**********************************************************************/
+/* Server discovery: a PMIx server that might already be running, and
+ * the URI to connect to it with. */
+
+struct server_candidate_t
+{
+  std::string uri;			/* "NSPACE.RANK;tcp4://ADDR:PORT" */
+  std::string source;			/* Where we found it */
+  struct sockaddr_storage addr;
+  socklen_t addr_len;
+  int fd;
+
+  server_candidate_t() : addr_len (0), fd (-1) {}
+
+  /* Parse the socket address out of uri, and return false if there is
+     none we can probe. */
+  bool parse()
+    {
+      const char *semi = strchr (uri.c_str(), ';');
+      const char *uri_addr = (semi ? semi + 1 : uri.c_str());
+      memset (&addr, 0, sizeof (addr));
+      if (0 == strncmp (uri_addr, "tcp4://", 7) || 0 == strncmp (uri_addr, "tcp://", 6))
+	{
+	  const char *host = strstr (uri_addr, "//") + 2;
+	  const char *colon = strrchr (host, ':');
+	  if (!colon)
+	    return false;
+	  struct sockaddr_in *in = (struct sockaddr_in *) &addr;
+	  in->sin_family = AF_INET;
+	  in->sin_port = htons (atoi (colon + 1));
+	  if (1 != inet_pton (AF_INET, std::string (host, colon - host).c_str(), &in->sin_addr))
+	    return false;
+	  addr_len = sizeof (*in);
+	  return true;
+	}  /* if */
+      if (0 == strncmp (uri_addr, "tcp6://", 7))
+	{
+	  const char *host = uri_addr + 7;
+	  const char *colon = strrchr (host, ':');
+	  if (!colon)
+	    return false;
+	  std::string host6 (host, colon - host);
+	  if (host6.size() >= 2 && '[' == host6[0])
+	    host6 = host6.substr (1, host6.size() - 2);
+	  struct sockaddr_in6 *in6 = (struct sockaddr_in6 *) &addr;
+	  in6->sin6_family = AF_INET6;
+	  in6->sin6_port = htons (atoi (colon + 1));
+	  if (1 != inet_pton (AF_INET6, host6.c_str(), &in6->sin6_addr))
+	    return false;
+	  addr_len = sizeof (*in6);
+	  return true;
+	}  /* if */
+      return false;
+    }  /* parse */
+};  /* server_candidate_t */
+
+/* Read the URI from the first line of a PMIx rendezvous file.  If
+   own_only_, the file must be a regular file that we own (or root
+   owns, if root_too_), so another user can't point us at their server
+   by leaving a file in a shared directory. */
+
+static std::string
+read_rendezvous_uri (const char *path_, bool own_only_ = false, bool root_too_ = false)
+{
+  std::string uri;
+  int fd = open (path_, O_RDONLY | O_CLOEXEC | (own_only_ ? O_NOFOLLOW : 0));
+  if (fd < 0)
+    return uri;
+  struct stat st;
+  if (own_only_ &&
+      (0 != fstat (fd, &st) || !S_ISREG (st.st_mode) ||
+       (st.st_uid != geteuid() && !(root_too_ && 0 == st.st_uid))))
+    {
+      debug_printf ("Ignoring rendezvous file %s, which isn't ours\n", path_);
+      close (fd);
+      return uri;
+    }  /* if */
+  FILE *file = fdopen (fd, "r");
+  if (!file)
+    {
+      close (fd);
+      return uri;
+    }  /* if */
+  char line[1024];
+  if (fgets (line, sizeof (line), file))
+    {
+      line[strcspn (line, "\r\n")] = '\0';
+      uri = line;
+    }  /* if */
+  fclose (file);
+  return uri;
+}  /* read_rendezvous_uri */
+
+/* Add a candidate for each rendezvous file in dir_ that a PMIx server
+   on this host has left: the system server's "pmix.sys.HOST", and the
+   "pmix.HOST.tool..." files of DVMs and other servers.  Only our own
+   files count, except that the system server's may also be root's. */
+
+static void
+find_rendezvous_files (const char *dir_,
+		       std::vector<server_candidate_t> &candidates_)
+{
+  if (NULL == dir_ || '\0' == dir_[0])
+    return;
+  char host[256];
+  if (0 != gethostname (host, sizeof (host)))
+    return;
+  host[sizeof (host) - 1] = '\0';
+  const std::string system_name = form_string ("pmix.sys.%s", host);
+  const std::string tool_prefix = form_string ("pmix.%s.tool", host);
+
+  DIR *dir = opendir (dir_);
+  if (!dir)
+    return;
+  while (struct dirent *entry = readdir (dir))
+    {
+      if (system_name != entry->d_name &&
+	  0 != strncmp (entry->d_name, tool_prefix.c_str(), tool_prefix.size()))
+	continue;
+      server_candidate_t candidate;
+      candidate.source = form_string ("%s/%s", dir_, entry->d_name);
+      candidate.uri = read_rendezvous_uri (candidate.source.c_str(), true,
+					   system_name == entry->d_name);
+      if (!candidate.uri.empty())
+	candidates_.push_back (candidate);
+    }  /* while */
+  closedir (dir);
+}  /* find_rendezvous_files */
+
+/**********************************************************************/
+/* Look for a PMIx server that is already running: the URI given with
+ * "--server-uri", the system server, and any DVMs that left
+ * rendezvous files in the usual places.  Probe all of them at once
+ * with non-blocking connects, and return the URI of the first one to
+ * accept a connection, or an empty string if none did within
+ * timeout_ seconds.  The probe is only a reachability check, which
+ * weeds out stale files quickly; it doesn't show that a PMIx server
+ * is listening.  Only connecting to it as a PMIx tool shows that,
+ * and that fails with an error if it isn't one.
+ */
+
+static std::string
+discover_server (double timeout_)
+{
+  NOTE_ENTRY_EXIT();
+
+  std::vector<server_candidate_t> candidates;
+  if (!server_uri.empty())
+    {
+      server_candidate_t candidate;
+      candidate.source = "--server-uri";
+      candidate.uri = (0 == strncmp (server_uri.c_str(), "file:", 5)
+		       ? read_rendezvous_uri (server_uri.c_str() + 5)
+		       : server_uri);
+      candidates.push_back (candidate);
+    }  /* if */
+  const char *system_tmpdir = getenv ("PMIX_SYSTEM_TMPDIR");
+  find_rendezvous_files (system_tmpdir ? system_tmpdir : "/tmp", candidates);
+  const char *server_tmpdir = getenv ("PMIX_SERVER_TMPDIR");
+  if (server_tmpdir && (!system_tmpdir || strcmp (server_tmpdir, system_tmpdir)))
+    find_rendezvous_files (server_tmpdir, candidates);
+  const char *tmpdir = getenv ("TMPDIR");
+  if (tmpdir && strcmp (tmpdir, "/tmp") &&
+      (!system_tmpdir || strcmp (tmpdir, system_tmpdir)) &&
+      (!server_tmpdir || strcmp (tmpdir, server_tmpdir)))
+    find_rendezvous_files (tmpdir, candidates);
+
+  /*
+   * Start connecting to all of them.
+   */
+  std::vector<struct pollfd> pfds;
+  std::vector<size_t> which;
+  for (size_t n = 0; n < candidates.size(); n++)
+    {
+      server_candidate_t &c = candidates[n];
+      debug_printf ("Server candidate '%s' from %s\n",
+		    c.uri.c_str(),
+		    c.source.c_str());
+      if (!c.parse())
+	continue;
+      c.fd = socket (c.addr.ss_family, SOCK_STREAM, 0);
+      if (c.fd < 0)
+	continue;
+      fcntl (c.fd, F_SETFL, fcntl (c.fd, F_GETFL) | O_NONBLOCK);
+      if (0 != connect (c.fd, (struct sockaddr *) &c.addr, c.addr_len) &&
+	  EINPROGRESS != errno)
+	continue;
+      struct pollfd pfd;
+      pfd.fd = c.fd;
+      pfd.events = POLLOUT;
+      pfd.revents = 0;
+      pfds.push_back (pfd);
+      which.push_back (n);
+    }  /* for */
+
+  /*
+   * Take the first one that connects.
+   */
+  std::string winner;
+  const double deadline = get_seconds() + timeout_;
+  size_t pending = pfds.size();
+  while (winner.empty() && pending > 0)
+    {
+      const double left = deadline - get_seconds();
+      if (left <= 0 || poll (&pfds.front(), pfds.size(), int (left * 1000) + 1) <= 0)
+	break;
+      for (size_t k = 0; k < pfds.size() && winner.empty(); k++)
+	{
+	  if (0 == pfds[k].revents)
+	    continue;
+	  int err = 0;
+	  socklen_t err_len = sizeof (err);
+	  getsockopt (pfds[k].fd, SOL_SOCKET, SO_ERROR, &err, &err_len);
+	  if (0 == err)
+	    winner = candidates[which[k]].uri;
+	  pfds[k].fd = -1;		/* poll() ignores it from now on */
+	  pending--;
+	}  /* for */
+    }  /* while */
+
+  for (size_t n = 0; n < candidates.size(); n++)
+    if (candidates[n].fd >= 0)
+      close (candidates[n].fd);
+  debug_printf ("Probed %lu server candidate(s): %s\n",
+		(unsigned long) which.size(),
+		winner.empty() ? "none answered" : winner.c_str());
+  return winner;
+}  /* discover_server */
+
+/**********************************************************************/
+/* A persistent DVM, kept alive between runs with "--keep-dvm".  The
+ * first run starts a DVM (prte) in the background, and later runs
+ * find it through the URI file in a per-user directory and attach to
+ * it as non-proxy runs.  Every run holds a shared lock on the "active"
+ * file while it uses the DVM, and touches it when it's done.  A reaper
+ * process terminates the DVM (with pterm) once nobody holds the lock
+ * and it hasn't been touched for the idle timeout.
+ */
+
+struct kept_dvm_t
+{
+  std::string dir;			/* Per-user DVM directory */
+  std::string uri_file;			/* Written by prte --report-uri */
+  std::string active_file;		/* Locked and touched by users */
+  std::string bin_dir;			/* Where prte, prun and pterm are, or "" */
+  int active_fd;
+
+  kept_dvm_t() : active_fd (-1) {}
+
+  ~kept_dvm_t()
+    {
+      if (active_fd >= 0)
+	{
+	  futimens (active_fd, NULL);	/* Start the idle timer */
+	  close (active_fd);
+	}  /* if */
+    }  /* ~kept_dvm_t */
+
+  std::string program (const char *name_) const
+    {
+      return bin_dir.empty() ? std::string (name_) : bin_dir + "/" + name_;
+    }  /* program */
+};  /* kept_dvm_t */
+
+/* Is the server in the URI file accepting connections? */
+
+static bool
+kept_dvm_is_running (const kept_dvm_t &dvm_)
+{
+  server_candidate_t candidate;
+  candidate.uri = read_rendezvous_uri (dvm_.uri_file.c_str(), true);
+  if (candidate.uri.empty() || !candidate.parse())
+    return false;
+  int fd = socket (candidate.addr.ss_family, SOCK_STREAM, 0);
+  if (fd < 0)
+    return false;
+  const bool running = (0 == connect (fd, (struct sockaddr *) &candidate.addr, candidate.addr_len));
+  close (fd);
+  return running;
+}  /* kept_dvm_is_running */
+
+/* Terminate the reaper's prte child, if it is still around, and exit.
+   This is for a DVM that never came up or stopped answering; one that
+   works is shut down with pterm instead. */
+
+static void
+kept_dvm_abandon (pid_t prte_pid_)
+{
+  if (kill (prte_pid_, SIGTERM) == 0)
+    {
+      const double deadline = get_seconds() + 5;
+      while (0 == waitpid (prte_pid_, NULL, WNOHANG) && get_seconds() < deadline)
+	usleep (10 * 1000);
+      kill (prte_pid_, SIGKILL);
+      waitpid (prte_pid_, NULL, 0);
+    }  /* if */
+  _exit (0);
+}  /* kept_dvm_abandon */
+
+/* The reaper: wait until the DVM is idle for the timeout, then
+   terminate it.  Runs in its own session as prte_pid_'s parent, and
+   never returns. */
+
+static void
+kept_dvm_reaper (const kept_dvm_t &dvm_, pid_t prte_pid_, int idle_timeout_)
+{
+  const unsigned int poll_seconds = (idle_timeout_ < 10 ? 1 : 5);
+  for (;;)
+    {
+      sleep (poll_seconds);
+      if (!kept_dvm_is_running (dvm_))
+	kept_dvm_abandon (prte_pid_);
+      int fd = open (dvm_.active_file.c_str(), O_RDWR | O_CLOEXEC | O_NOFOLLOW);
+      if (fd < 0)
+	continue;
+      struct stat st;
+      const bool idle = (0 == flock (fd, LOCK_EX | LOCK_NB) &&
+			 0 == fstat (fd, &st) &&
+			 time (NULL) - st.st_mtime >= idle_timeout_);
+      if (idle)
+	{
+	  /*
+	   * Keep the exclusive lock while the DVM goes away, so that a
+	   * new run starts a new DVM instead of using this one.
+	   */
+	  const std::string uri_arg = "file:" + dvm_.uri_file;
+	  const std::string pterm = dvm_.program ("pterm");
+	  pid_t pid = fork();
+	  if (0 == pid)
+	    {
+	      execlp (pterm.c_str(), pterm.c_str(), "--dvm-uri", uri_arg.c_str(), (char *) NULL);
+	      _exit (127);
+	    }  /* if */
+	  if (pid > 0)
+	    waitpid (pid, NULL, 0);
+	  waitpid (prte_pid_, NULL, 0);
+	  unlink (dvm_.uri_file.c_str());
+	  _exit (0);
+	}  /* if */
+      close (fd);			/* Also releases the lock */
+    }  /* for */
+}  /* kept_dvm_reaper */
+
+/**********************************************************************/
+/* Find the kept DVM, starting it (and its reaper) if it isn't running,
+ * and take a shared lock on it for this run.  Returns the DVM's URI,
+ * or an empty string if it can't be started.  The DVM directory is in
+ * a shared place, so it must be a directory that only we can use;
+ * otherwise another user could plant a URI file in it and have our
+ * jobs launched by their server.
+ */
+
+static std::string
+setup_kept_dvm (kept_dvm_t &dvm_, const char *launcher_name_)
+{
+  NOTE_ENTRY_EXIT();
+
+  const char *base = getenv ("XDG_RUNTIME_DIR");
+  if (!is_usable_tmpfs (base))
+    base = "/tmp";
+  dvm_.dir = form_string ("%s/%s.dvm.%d", base, whoami, int (geteuid()));
+  dvm_.uri_file = dvm_.dir + "/dvm.uri";
+  dvm_.active_file = dvm_.dir + "/active";
+  if (const char *slash = strrchr (launcher_name_, '/'))
+    dvm_.bin_dir = std::string (launcher_name_, slash - launcher_name_);
+  if (0 != mkdir (dvm_.dir.c_str(), S_IRWXU) && EEXIST != errno)
+    {
+      debug_printf ("Can't create '%s': %s\n",
+		    dvm_.dir.c_str(),
+		    get_errno_string().c_str());
+      return std::string();
+    }  /* if */
+  struct stat dir_st;
+  if (0 != lstat (dvm_.dir.c_str(), &dir_st) ||
+      !S_ISDIR (dir_st.st_mode) ||
+      dir_st.st_uid != geteuid() ||
+      0 != (dir_st.st_mode & (S_IRWXG | S_IRWXO)))
+    fatal_error ("Refusing to use '%s' for \"--keep-dvm\": it must be a "
+		 "directory that only we own and can access (mode 0700)",
+		 dvm_.dir.c_str());
+
+  /*
+   * Serialize concurrent runs while we find or start the DVM.
+   */
+  const std::string lock_file = dvm_.dir + "/lock";
+  int lock_fd = open (lock_file.c_str(), O_RDWR | O_CREAT | O_CLOEXEC | O_NOFOLLOW,
+		      S_IRUSR | S_IWUSR);
+  if (lock_fd < 0 || 0 != flock (lock_fd, LOCK_EX))
+    {
+      if (lock_fd >= 0)
+	close (lock_fd);
+      return std::string();
+    }  /* if */
+
+  /*
+   * Take the shared "in use" lock first, so the reaper can't
+   * terminate the DVM while we start using it.  If the reaper holds
+   * it exclusively, the DVM is going away, so wait for that.
+   */
+  dvm_.active_fd = open (dvm_.active_file.c_str(), O_RDWR | O_CREAT | O_CLOEXEC | O_NOFOLLOW,
+			 S_IRUSR | S_IWUSR);
+  if (dvm_.active_fd >= 0)
+    flock (dvm_.active_fd, LOCK_SH);
+
+  std::string uri;
+  if (kept_dvm_is_running (dvm_))
+    {
+      uri = read_rendezvous_uri (dvm_.uri_file.c_str(), true);
+      debug_printf ("Reusing the kept DVM at '%s'\n", uri.c_str());
+    }  /* if */
+  else
+    {
+      unlink (dvm_.uri_file.c_str());
+      const std::string prte = dvm_.program ("prte");
+      debug_printf ("Starting a kept DVM with '%s', idle timeout %d seconds\n",
+		    prte.c_str(),
+		    keep_dvm_idle_timeout);
+      pid_t pid = fork();
+      if (0 == pid)
+	{
+	  /*
+	   * Detach from us, start the DVM, and become its reaper.  Don't
+	   * keep our locks or our stdio open.
+	   */
+	  setsid();
+	  close (lock_fd);
+	  if (dvm_.active_fd >= 0)
+	    close (dvm_.active_fd);
+	  int null_fd = open ("/dev/null", O_RDWR);
+	  if (null_fd >= 0)
+	    {
+	      dup2 (null_fd, STDIN_FILENO);
+	      dup2 (null_fd, STDOUT_FILENO);
+	      dup2 (null_fd, STDERR_FILENO);
+	      close (null_fd);
+	    }  /* if */
+	  pid_t prte_pid = fork();
+	  if (0 == prte_pid)
+	    {
+	      execlp (prte.c_str(), prte.c_str(),
+		      "--report-uri", dvm_.uri_file.c_str(),
+		      (char *) NULL);
+	      _exit (127);
+	    }  /* if */
+	  if (prte_pid < 0)
+	    _exit (1);
+	  const double deadline = get_seconds() + 60;
+	  while (!kept_dvm_is_running (dvm_) && get_seconds() < deadline)
+	    {
+	      if (0 != waitpid (prte_pid, NULL, WNOHANG))
+		_exit (1);		/* prte exited, or is gone */
+	      usleep (10 * 1000);
+	    }  /* while */
+	  if (!kept_dvm_is_running (dvm_))
+	    kept_dvm_abandon (prte_pid);
+	  kept_dvm_reaper (dvm_, prte_pid, keep_dvm_idle_timeout);
+	}  /* if */
+
+      /*
+       * Wait for the DVM to report its URI and start listening.
+       */
+      if (pid > 0)
+	{
+	  const double deadline = get_seconds() + 60;
+	  while (!kept_dvm_is_running (dvm_) && get_seconds() < deadline)
+	    usleep (10 * 1000);
+	  if (kept_dvm_is_running (dvm_))
+	    uri = read_rendezvous_uri (dvm_.uri_file.c_str(), true);
+	}  /* if */
+      debug_printf ("Kept DVM %s\n",
+		    uri.empty() ? "failed to start" : uri.c_str());
+    }  /* else */
+
+  close (lock_fd);
+  return uri;
+}  /* setup_kept_dvm */
+
 /**********************************************************************/
 /* Initialize ourselves as a PMIx tool. */
 
@@ -1361,6 +5481,9 @@ initialize_as_tool (bool proxy_run_)
     {
 				/* Use the system connection first, if available. */
 //      INFO_NEXT.load (PMIX_CONNECT_SYSTEM_FIRST, true);
+				/* Connect to the server we discovered */
+      if (!server_uri.empty())
+	INFO_NEXT.load (PMIX_SERVER_URI, server_uri.c_str());
     }  /* if */
   else
     {
@@ -1386,13 +5509,6 @@ initialize_as_tool (bool proxy_run_)
   if (PMIX_SUCCESS != rc)
     pmix_fatal_error (rc, "PMIx_tool_init() failed");
 
-				/* If the launcher is going to start a PMIx server... */
-  if (proxy_run_)
-    {
-				/* Setup the session paths */
-      setup_session_paths();
-    }	/* if */
-
   debug_printf ("Running as a PMIx tool\n");
 }  /* initialize_as_tool */
 
@@ -1400,16 +5516,14 @@ initialize_as_tool (bool proxy_run_)
 /* Register default event handler */
 
 static void
-register_default_event_handler()
+register_default_event_handler (event_handler_batch_t &batch_)
 {
   NOTE_ENTRY_EXIT();
 
   debug_printf ("Registering default event handler\n");
 
-  register_event_handler_t event_registrar;
-  pmix::status_t rc =
-    event_registrar.register_event_handler (default_notification_fn,
-					    evhandler_reg_callbk);
+  event_handler_batch_t::registration_t &r = batch_.add ("default");
+  pmix::status_t rc = batch_.start (r, default_notification_fn);
   if (PMIX_SUCCESS != rc)
     pmix_fatal_error (rc, "Registering default event handler");
 }  /* register_default_event_handler */
@@ -1420,29 +5534,23 @@ register_default_event_handler()
  * prun, mpirun, mpiexec, etc. */
 
 static void
-register_launcher_ready (release_t *launcher_ready_)
+register_launcher_ready (event_handler_batch_t &batch_,
+			 release_t *launcher_ready_)
 {
   NOTE_ENTRY_EXIT();
 
   debug_printf ("Registering \"launcher-ready\" event handler\n");
 
-  pmix::status_t code = PMIX_LAUNCHER_READY;
-  DEFINE_INFO();
+  event_handler_batch_t::registration_t &r =
+    batch_.add ("launcher-ready", PMIX_LAUNCHER_READY);
+  std::vector<pmix::info_t> &info = r.info;
   INFO_NEXT.load (PMIX_EVENT_RETURN_OBJECT, (void *) launcher_ready_);
   INFO_NEXT.load (PMIX_EVENT_HDLR_NAME, "LAUNCHER-READY");
 
-  register_event_handler_t event_registrar;
-  pmix::status_t rc =
-    event_registrar.register_event_handler (&code, 1,
-					    &info.front(), info.size(),
-					    launcher_release_fn,
-					    evhandler_reg_callbk);
+  pmix::status_t rc = batch_.start (r, launcher_release_fn);
   if (PMIX_SUCCESS != rc)
     pmix_fatal_error (rc,
 		      "Registering \"launcher-ready\" event handler");
-  if (PMIX_SUCCESS != event_registrar.lock_status)
-    pmix_fatal_error (event_registrar.lock_status,
-		      "Registering \"launcher-ready\" event handler: lock status");
 }  /* register_launcher_ready */
 
 /**********************************************************************/
@@ -1451,62 +5559,141 @@ register_launcher_ready (release_t *launcher_ready_)
  * the MPIR_proctable[]. */
 
 static void
-register_launcher_complete (release_t *launcher_complete_)
+register_launcher_complete (event_handler_batch_t &batch_,
+			    release_t *launcher_complete_)
 {
   NOTE_ENTRY_EXIT();
 
   debug_printf ("Registering \"launcher-complete\" event handler\n");
 
-  pmix::status_t code = PMIX_LAUNCH_COMPLETE;
-  DEFINE_INFO();
+  event_handler_batch_t::registration_t &r =
+    batch_.add ("launch-complete", PMIX_LAUNCH_COMPLETE);
+  std::vector<pmix::info_t> &info = r.info;
   INFO_NEXT.load (PMIX_EVENT_RETURN_OBJECT, (void *) launcher_complete_);
   INFO_NEXT.load (PMIX_EVENT_HDLR_NAME, "LAUNCHER-COMPLETE");
 
-  register_event_handler_t event_registrar;
-  pmix::status_t rc =
-    event_registrar.register_event_handler (&code, 1,
-					    &info.front(), info.size(),
-					    debugger_release_fn,
-					    evhandler_reg_callbk);
+  pmix::status_t rc = batch_.start (r, debugger_release_fn);
+  if (PMIX_SUCCESS != rc)
+    pmix_fatal_error (rc,
+		      "Registering \"launch-complete\" event handler");
+}  /* register_launcher_complete */
+
+/**********************************************************************/
+/* Register to receive the "job-start" events for the child jobs that
+ * the application spawns.  Later "launch-complete" events also report
+ * child jobs; those arrive through register_launcher_complete()'s
+ * handler. */
+
+static void
+register_child_jobs (event_handler_batch_t &batch_,
+		     child_jobs_t *children_)
+{
+  NOTE_ENTRY_EXIT();
+
+#if defined(PMIX_EVENT_JOB_START)
+  debug_printf ("Registering \"job-start\" event handler\n");
+
+  event_handler_batch_t::registration_t &r =
+    batch_.add ("job-start", PMIX_EVENT_JOB_START);
+  std::vector<pmix::info_t> &info = r.info;
+  INFO_NEXT.load (PMIX_EVENT_RETURN_OBJECT, (void *) children_);
+  INFO_NEXT.load (PMIX_EVENT_HDLR_NAME, "JOB-START");
+
+  pmix::status_t rc = batch_.start (r, child_job_fn);
+  if (PMIX_SUCCESS != rc)
+    pmix_fatal_error (rc,
+		      "Registering \"job-start\" event handler");
+#else
+  debug_printf ("No PMIX_EVENT_JOB_START, only following launch-complete events\n");
+#endif
+}  /* register_child_jobs */
+
+/**********************************************************************/
+/* Register to receive the "ready-for-debug" events that application
+ * processes send when they stop in PMIx_Init(), so we can stream the
+ * proc table to the debugger as they report in. */
+
+static void
+register_ready_for_debug (event_handler_batch_t &batch_,
+			  stream_t *stream_)
+{
+  NOTE_ENTRY_EXIT();
+
+  debug_printf ("Registering \"ready-for-debug\" event handler\n");
+
+  event_handler_batch_t::registration_t &r =
+    batch_.add ("ready-for-debug", PMIX_READY_FOR_DEBUG);
+  std::vector<pmix::info_t> &info = r.info;
+  INFO_NEXT.load (PMIX_EVENT_RETURN_OBJECT, (void *) stream_);
+  INFO_NEXT.load (PMIX_EVENT_HDLR_NAME, "READY-FOR-DEBUG");
+
+  pmix::status_t rc = batch_.start (r, ready_for_debug_fn);
+  if (PMIX_SUCCESS != rc)
+    pmix_fatal_error (rc,
+		      "Registering \"ready-for-debug\" event handler");
+}  /* register_ready_for_debug */
+
+/**********************************************************************/
+/* Register to receive the events that tell whether the application
+ * uses PMIx: "ready-for-debug", and the process and job termination
+ * events.  This handler goes first, and passes the events on. */
+
+static void
+register_app_watch (event_handler_batch_t &batch_,
+		    app_watch_t *watch_)
+{
+  NOTE_ENTRY_EXIT();
+
+  debug_printf ("Registering \"app-watch\" event handler\n");
+
+  event_handler_batch_t::registration_t &r =
+    batch_.add ("app-watch", PMIX_READY_FOR_DEBUG);
+  r.codes.push_back (PMIX_ERR_JOB_TERMINATED);
+#if defined(PMIX_EVENT_JOB_END)
+  r.codes.push_back (PMIX_EVENT_JOB_END);
+#endif
+#if defined(PMIX_EVENT_PROC_TERMINATED)
+  r.codes.push_back (PMIX_EVENT_PROC_TERMINATED);
+#endif
+#if defined(PMIX_ERR_PROC_TERM_WO_SYNC)
+  r.codes.push_back (PMIX_ERR_PROC_TERM_WO_SYNC);
+#endif
+  std::vector<pmix::info_t> &info = r.info;
+  INFO_NEXT.load (PMIX_EVENT_RETURN_OBJECT, (void *) watch_);
+  INFO_NEXT.load (PMIX_EVENT_HDLR_NAME, "APP-WATCH");
+  INFO_NEXT.load (PMIX_EVENT_HDLR_PREPEND, true);
+
+  pmix::status_t rc = batch_.start (r, app_watch_fn);
   if (PMIX_SUCCESS != rc)
     pmix_fatal_error (rc,
-		      "Registering \"launch-complete\" event handler");
-  if (PMIX_SUCCESS != event_registrar.lock_status)
-    pmix_fatal_error (event_registrar.lock_status,
-		      "Registering \"launch-complete\" event handler: lock status");
-}  /* register_launcher_complete */
+		      "Registering \"app-watch\" event handler");
+}  /* register_app_watch */
 
 /**********************************************************************/
 /* Register callback for when the launcher terminates. */
 
 static void
-register_launcher_terminate (release_t *launcher_terminate_,
+register_launcher_terminate (event_handler_batch_t &batch_,
+			     release_t *launcher_terminate_,
 			     const char *launcher_nspace_)
 {
   NOTE_ENTRY_EXIT();
 
   debug_printf ("Registering \"launcher-terminate\" event handler\n");
 
-  pmix::status_t code = PMIX_ERR_JOB_TERMINATED;
+  event_handler_batch_t::registration_t &r =
+    batch_.add ("launcher-terminate", PMIX_ERR_JOB_TERMINATED);
   launcher_terminate_->nspace = strdup (launcher_nspace_);
-  DEFINE_INFO();
+  std::vector<pmix::info_t> &info = r.info;
   INFO_NEXT.load (PMIX_EVENT_RETURN_OBJECT, launcher_terminate_);
 				/* Only call me back when this specific job terminates */
   pmix::proc_t proc (launcher_nspace_, PMIX_RANK_WILDCARD);
   INFO_NEXT.load (PMIX_EVENT_AFFECTED_PROC, &proc, PMIX_PROC);
 
-  register_event_handler_t event_registrar;
-  pmix::status_t rc =
-    event_registrar.register_event_handler (&code, 1,
-					    &info.front(), info.size(),
-					    launcher_release_fn,
-					    evhandler_reg_callbk);
+  pmix::status_t rc = batch_.start (r, launcher_release_fn);
   if (PMIX_SUCCESS != rc)
     pmix_fatal_error (rc,
 		      "Registering \"launch-terminate\" event handler");
-  if (PMIX_SUCCESS != event_registrar.lock_status)
-    pmix_fatal_error (event_registrar.lock_status,
-		      "Registering \"launch-terminate\" event handler: lock status");
 }  /* register_launcher_terminate */
 
 /**********************************************************************/
@@ -1517,6 +5704,21 @@ connect_to_server()
 {
   NOTE_ENTRY_EXIT();
 
+  /*
+   * Wait for the launcher to write its rendezvous file.  Once it has,
+   * its server is listening, so only a few quick retries are needed.
+   * If it hasn't, fall back to retrying once a second, unless the
+   * connect phase has a deadline: then a launcher that hasn't started
+   * its server by the deadline has stalled.
+   */
+  const double deadline = launch_state.get_deadline();
+  const double rendezvous_timeout = (0 == deadline
+				     ? 60
+				     : std::max (deadline - get_seconds(), 0.0));
+  const bool rendezvous_ready = wait_for_rendezvous_file (rendezvous_timeout);
+  if (!rendezvous_ready && 0 != deadline)
+    launch_state.stalled();
+
   /*
    * Attributes for connecting to the server.
    */
@@ -1524,9 +5726,9 @@ connect_to_server()
 				/* Rendezvous file passed in PMIX_LAUNCHER_RENDEZVOUS_FILE */
   INFO_NEXT.load (PMIX_TOOL_ATTACHMENT_FILE, rendezvous_filename.c_str());
 				/* Number of times to try to connect */
-  INFO_NEXT.load (PMIX_CONNECT_MAX_RETRIES, uint32_t(100));
+  INFO_NEXT.load (PMIX_CONNECT_MAX_RETRIES, uint32_t(rendezvous_ready ? 10 : 100));
 				/* Number of seconds to wait between connect attempts */
-  INFO_NEXT.load (PMIX_CONNECT_RETRY_DELAY, uint32_t(0));
+  INFO_NEXT.load (PMIX_CONNECT_RETRY_DELAY, uint32_t(rendezvous_ready ? 0 : 1));
 
   debug_printf ("Connecting tool to server\n");
   pmix::status_t rc = PMIx_tool_connect_to_server (&myproc, &info.front(), info.size());
@@ -1535,6 +5737,51 @@ connect_to_server()
   debug_printf ("Connected tool to server\n");
 }  /* connect_to_server */
 
+/**********************************************************************/
+/* Does the name of the environment variable env_ ("NAME=VALUE") match
+ * one of the fnmatch() patterns_? */
+
+static bool
+env_name_matches (const char *env_, const std::vector<std::string> &patterns_)
+{
+  if (patterns_.empty())
+    return false;
+  const char *equals = strchr (env_, '=');
+  const std::string name (env_, equals ? equals - env_ : strlen (env_));
+  for (size_t n = 0; n < patterns_.size(); n++)
+    if (0 == fnmatch (patterns_[n].c_str(), name.c_str(), 0))
+      return true;
+  return false;
+}  /* env_name_matches */
+
+/* Add the comma-separated patterns in list_ to patterns_. */
+
+static void
+add_env_patterns (const char *list_, std::vector<std::string> &patterns_)
+{
+  while (*list_)
+    {
+      const char *comma = strchr (list_, ',');
+      const size_t len = (comma ? comma - list_ : strlen (list_));
+      if (len)
+	patterns_.push_back (std::string (list_, len));
+      list_ += len + (comma ? 1 : 0);
+    }  /* while */
+}  /* add_env_patterns */
+
+/**********************************************************************/
+/* Does the PMIx library merge the environment we give the launcher
+ * into the one it inherits from us, rather than replace it?  PMIx 4
+ * does; don't count on it with older versions. */
+
+static bool
+pmix_merges_app_env()
+{
+  const char *version = PMIx_Get_version();
+  const char *digit = (version ? strpbrk (version, "0123456789") : NULL);
+  return digit && atoi (digit) >= 4;
+}  /* pmix_merges_app_env */
+
 /**********************************************************************/
 /* Spawn an intermediate launcher (prun) using PMIx_Spawn().  Tell the
  * launcher to wait for directives prior to spawning the
@@ -1563,12 +5810,67 @@ spawn_launcher (char *launcher_nspace_,
     }  /* for */
 
 				/* Copy the environment, if it's a proxy run */
+  std::vector<std::string> unset_names;
   if (proxy_run_)
     {
+      /*
+       * "--env-transfer=delta" only sends the variables set or changed
+       * since we started (by PMIx_tool_init(), for example), only
+       * those matching "--env-allow" if it's given, and unsets the
+       * ones unset since.  That relies on the PMIx library merging
+       * app.env into the environment the launcher inherits from us,
+       * instead of replacing it, or the launcher would be left
+       * without PATH, HOME and the like; otherwise we send everything.
+       * "--env-deny" takes variables out of what we send in either
+       * mode.
+       */
+      env_transfer_t transfer = env_transfer;
+      if (env_delta == transfer && !pmix_merges_app_env())
+	{
+	  debug_printf ("PMIx '%s' may not merge the environment we pass, "
+			"so passing all of it\n", PMIx_Get_version());
+	  transfer = env_full;
+	}  /* if */
+      std::vector<std::string> names;	/* Of our variables, sorted */
+      size_t full_count = 0, full_size = 0, sent_count = 0, sent_size = 0;
       for (char **envp = environ; *envp; envp++)
 	{
+	  full_count++;
+	  full_size += strlen (*envp) + 1;
+	  if (env_delta == transfer)
+	    {
+	      names.push_back (std::string (*envp, strcspn (*envp, "=")));
+	      if (std::binary_search (startup_environ.begin(), startup_environ.end(),
+				      std::string (*envp)) ||
+		  (!env_allow.empty() && !env_name_matches (*envp, env_allow)))
+		continue;
+	    }  /* if */
+	  if (env_name_matches (*envp, env_deny))
+	    continue;
 	  app.env_append (*envp);
+	  sent_count++;
+	  sent_size += strlen (*envp) + 1;
 	}  /* for */
+      if (env_delta == transfer)
+	{
+	  std::sort (names.begin(), names.end());
+	  for (size_t n = 0; n < startup_environ.size(); n++)
+	    {
+	      const char *env = startup_environ[n].c_str();
+	      const std::string name (env, strcspn (env, "="));
+	      if (!std::binary_search (names.begin(), names.end(), name) &&
+		  (env_allow.empty() || env_name_matches (env, env_allow)) &&
+		  !env_name_matches (env, env_deny))
+		unset_names.push_back (name);
+	    }  /* for */
+	}  /* if */
+      debug_printf ("Passing %lu of %lu environment variables (%lu of %lu bytes) "
+		    "to the launcher, and unsetting %lu\n",
+		    (unsigned long) sent_count,
+		    (unsigned long) full_count,
+		    (unsigned long) sent_size,
+		    (unsigned long) full_size,
+		    (unsigned long) unset_names.size());
     }  /* if */
 				/* Try to use the same working directory */
   char cwd[PATH_MAX];
@@ -1580,8 +5882,12 @@ spawn_launcher (char *launcher_nspace_,
    * Provide job-level directives so the apps do what the user requested
    */
   DEFINE_INFO();
+  info.reserve (10 + unset_names.size());	/* Growing would copy the infos */
 				/* Map by slot */
   INFO_NEXT.load (PMIX_MAPBY, "slot");
+				/* Unset what we have unset since we started */
+  for (size_t n = 0; n < unset_names.size(); n++)
+    INFO_NEXT.load (PMIX_UNSET_ENVAR, unset_names[n].c_str());
 				/* Set some environment variables */
   if (proxy_run_)
     {
@@ -1621,10 +5927,11 @@ spawn_launcher (char *launcher_nspace_,
 }  /* spawn_launcher */
 
 /**********************************************************************/
-/* Send the launch directives. */
+/* Send the launch directives.  If stop_in_init_ is false, the
+ * application processes are not stopped for the debugger. */
 
 static void
-send_launch_directives (const char *launcher_nspace_)
+send_launch_directives (const char *launcher_nspace_, bool stop_in_init_)
 {
   NOTE_ENTRY_EXIT();
 
@@ -1642,9 +5949,19 @@ send_launch_directives (const char *launcher_nspace_)
   DINFO_NEXT.load (PMIX_PREPEND_ENVAR, &envar_path, PMIX_ENVAR);
 #endif
 				/* Stop the processes in PMIx_Init() */
-  DINFO_NEXT.load (PMIX_DEBUG_STOP_IN_INIT, true);
+  if (stop_in_init_)
+    DINFO_NEXT.load (PMIX_DEBUG_STOP_IN_INIT, true);
 				/* Notify us when the job is launched */
   DINFO_NEXT.load (PMIX_NOTIFY_LAUNCH, true);
+				/* And when it, or a process, terminates */
+				/* early, to catch non-PMIx applications */
+  if (stop_in_init_)
+    {
+      DINFO_NEXT.load (PMIX_NOTIFY_COMPLETION, true);
+#if defined(PMIX_NOTIFY_PROC_ABNORMAL_TERMINATION)
+      DINFO_NEXT.load (PMIX_NOTIFY_PROC_ABNORMAL_TERMINATION, true);
+#endif
+    }  /* if */
 
 				/* Fill in the data array fields */
   darray.type = PMIX_INFO;
@@ -1671,6 +5988,60 @@ send_launch_directives (const char *launcher_nspace_)
     pmix_fatal_error (rc, "PMIx_Notify_event() failed sending PMIX_LAUNCH_DIRECTIVE");
 }   /* send_launch_directives */
 
+/**********************************************************************/
+/* Release the application processes as the tool opens their gates in
+ * MPIR_shim_debug_gates.  The gates are polled, and every gate opened
+ * since the last poll is released with one targeted event per
+ * namespace, since child jobs share the proc table.  Returns
+ * when every process in the proc table has been released, when the
+ * tool sets MPIR_debug_gate, or when the launcher terminates.  If the
+ * tool never opens the gates, the "running" phase's deadline (if one
+ * is set) kills the job.
+ */
+
+static void
+release_debug_gates (release_t *launcher_terminate_)
+{
+  NOTE_ENTRY_EXIT();
+
+  const useconds_t poll_usec = 10 * 1000;
+  std::vector<char> released;
+  size_t nreleased = 0;
+  for (;;)
+    {
+      if (0 != MPIR_debug_gate || launcher_terminate_->latch.is_open())
+	break;
+
+      const size_t n = MPIR_proctable_size;
+      released.resize (n, 0);
+				/* Ranks to release, by namespace id */
+      std::vector<std::vector<pmix::rank_t> > ranks (mpir_nspaces.size());
+      size_t nopened = 0;
+      for (size_t i = 0; i < n; i++)
+	if (!released[i] && MPIR_shim_debug_gates[i])
+	  {
+	    released[i] = 1;
+	    ranks[mpir_table.nspace_ids[i]].push_back (mpir_table.ranks[i]);
+	    nopened++;
+	  }  /* if */
+      for (uint32_t id = 0; id < ranks.size(); id++)
+	if (!ranks[id].empty())
+	  release_procs (mpir_nspaces.string (id), ranks[id]);
+      if (0 != nopened)
+	{
+	  nreleased += nopened;
+	  debug_printf ("Released %lu procs through their gates, %lu of %lu\n",
+			(unsigned long) nopened,
+			(unsigned long) nreleased,
+			(unsigned long) n);
+	}  /* if */
+      if (n > 0 && nreleased == n)
+	break;
+      launch_state.check();
+      usleep (poll_usec);
+    }  /* for */
+}  /* release_debug_gates */
+
 /**********************************************************************/
 /* Release the launcher process and allow it to run. */
 
@@ -1679,20 +6050,8 @@ release_launcher_process (const char *app_nspace_)
 {
   NOTE_ENTRY_EXIT();
 
-  pmix::proc_t proc (app_nspace_, PMIX_RANK_WILDCARD);
-  DEFINE_INFO();
-				/* Deliver to the target nspace */
-  INFO_NEXT.load (PMIX_EVENT_CUSTOM_RANGE, &proc, PMIX_PROC);
-  INFO_NEXT.load (PMIX_EVENT_NON_DEFAULT, true);
-
-  debug_printf ("Sending debugger release\n");
-  pmix::status_t rc =
-    PMIx_Notify_event (PMIX_ERR_DEBUGGER_RELEASE,
-		       NULL, PMIX_RANGE_CUSTOM,
-		       &info.front(), info.size(),
-		       NULL, NULL);
-  if (PMIX_SUCCESS != rc)
-    pmix_fatal_error (rc, "PMIx_Notify_event() failed sending PMIX_ERR_DEBUGGER_RELEASE");
+				/* Deliver to the whole target nspace */
+  release_procs (app_nspace_, std::vector<pmix::rank_t> (1, PMIX_RANK_WILDCARD));
 }  /* release_launcher_process */
 
 /**********************************************************************/
@@ -1720,24 +6079,24 @@ setup_signal_handlers()
 }  /* setup_signal_handlers */
 
 /**********************************************************************/
-/* Setup the pmix_prefix variable, which allows our PMIx to find its
-   shared libraries and files.  The basic idea here is that by looking
-   at argv[0] and possibly searching $PATH, we can sniff around for
-   where OpenPMIx is installed relatve to where this program is
-   installed. It's not a 100% reliable, but works for at least
-   TotalView.  */
+/* The file whose presence says that prefix_ is where PMIx is installed. */
 
-static void
-setup_pmix_prefix (const char *argv0_)
+static std::string
+pmix_probe_path (const std::string &prefix_)
 {
-  NOTE_ENTRY_EXIT();
+#if defined(__APPLE__)
+  return prefix_ + "/lib/libpmix.dylib";
+#else
+  return prefix_ + "/lib/libpmix.so";
+#endif
+}  /* pmix_probe_path */
 
-				/* If argv[0] is null or empty, return */
-  if (0 == argv0_ || '\0' == argv0_[0])
-    return;
-				/* If "--pmix-prefix" was specified, return */
-  if (!pmix_prefix.empty())
-    return;
+/* Search for where OpenPMIx is installed relative to where this
+   program is installed, returning "" if it isn't found.  */
+
+static std::string
+search_pmix_prefix (const char *argv0_)
+{
 				/* If the program name contains a '/', */
 				/* we don't need to search $PATH */
   scoped_ptr<char> program_path (0 != strchr (argv0_, '/') ? strdup (argv0_) : 0);
@@ -1801,21 +6160,265 @@ setup_pmix_prefix (const char *argv0_)
 	       it != end;
 	       ++it)
 	    {
+	      if (0 == access (pmix_probe_path (*it).c_str(), F_OK))
+		return *it;
+	    }  /* for */
+	}  /* if */
+    }  /* if */
+  return std::string();
+}  /* search_pmix_prefix */
+
+/**********************************************************************/
+/* Load libpmix, from pmix_prefix if we know it, and fill in pmix_api.
+   Without "--enable-pmix-dlopen", libpmix is linked in and there is
+   nothing to do. */
+
+static void
+load_pmix_library()
+{
+#if defined(MPIRSHIM_PMIX_DLOPEN)
+  NOTE_ENTRY_EXIT();
+
 #if defined(__APPLE__)
-	      std::string probe (*it + "/lib/libpmix.dylib");
+  const std::string library ("libpmix.dylib");
 #else
-	      std::string probe (*it + "/lib/libpmix.so");
+  const std::string library ("libpmix.so");
 #endif
-	      if (0 == access (probe.c_str(), F_OK))
-		{
-		  debug_printf ("Setting pmix_prefix to \"%s\"\n",
-				it->c_str());
-		  pmix_prefix = *it;
-		  break;
-		}  /* if */
-	    }  /* for */
+  std::vector<std::string> candidates;
+  if (!pmix_prefix.empty())
+    {
+      candidates.push_back (pmix_prefix + "/lib/" + library);
+      candidates.push_back (pmix_prefix + "/lib64/" + library);
+    }  /* if */
+				/* Where configure found it */
+  candidates.push_back (MPIRSHIM_PMIX_LIBDIR "/" + library);
+				/* Wherever the dynamic loader finds it */
+  candidates.push_back (library);
+#if !defined(__APPLE__)
+  candidates.push_back (library + ".2");
+#endif
+
+  /*
+   * PMIx loads its plugins with dlopen(), and they need libpmix's
+   * symbols, so load it RTLD_GLOBAL.
+   */
+  void *handle = 0;
+  std::string errors;
+  for (size_t n = 0; n < candidates.size() && !handle; n++)
+    {
+      handle = dlopen (candidates[n].c_str(), RTLD_NOW | RTLD_GLOBAL);
+      if (handle)
+	debug_printf ("Loaded PMIx from \"%s\"\n", candidates[n].c_str());
+      else
+	errors += form_string ("\n  %s", dlerror());
+    }  /* for */
+  if (!handle)
+    fatal_error ("Could not load the PMIx library:%s", errors.c_str());
+
+#define PMIX_API_LOAD(name_)						\
+  pmix_api.name_##_fn = (__typeof__ (pmix_api.name_##_fn)) dlsym (handle, #name_); \
+  if (!pmix_api.name_##_fn)						\
+    fatal_error ("Could not find %s() in the PMIx library", #name_);
+  PMIX_API_FUNCTIONS (PMIX_API_LOAD)
+#undef PMIX_API_LOAD
+
+  /*
+   * The value functions the PMIx macros need, by their PMIx 4.2 name
+   * or their older one.
+   */
+#define PMIX_API_LOAD_VALUE_FN(member_, name_, old_name_)		\
+  pmix_api.member_ = (__typeof__ (pmix_api.member_)) dlsym (handle, name_); \
+  if (!pmix_api.member_)						\
+    pmix_api.member_ = (__typeof__ (pmix_api.member_)) dlsym (handle, old_name_);
+  PMIX_API_LOAD_VALUE_FN (value_load_fn, "PMIx_Value_load", "pmix_value_load");
+  PMIX_API_LOAD_VALUE_FN (value_xfer_fn, "PMIx_Value_xfer", "pmix_value_xfer");
+  PMIX_API_LOAD_VALUE_FN (value_destruct_fn, "PMIx_Value_destruct", "pmix_value_destruct");
+#undef PMIX_API_LOAD_VALUE_FN
+  if (!pmix_api.value_load_fn || !pmix_api.value_xfer_fn)
+    fatal_error ("Could not find PMIx_Value_load() or PMIx_Value_xfer() "
+		 "in the PMIx library");
+#endif  /* MPIRSHIM_PMIX_DLOPEN */
+}  /* load_pmix_library */
+
+/**********************************************************************/
+/* Searching $PATH and probing the install tree is slow on network file
+   systems, so remember what was found in a per-user cache.  An entry
+   is keyed by the resolved path of this executable, and starts with
+   everything the answer depends on: the executable's identity, argv[0]
+   and the directory or $PATH it was resolved against.  It ends with
+   the prefix found and the identity of its libpmix, so replacing
+   either the shim or PMIx invalidates it.  Entries are replaced by
+   rename(), so a concurrent run never sees a partial one.  Only
+   successful searches are cached. */
+
+/* Identify a file by device, inode, size and modification time, or
+   return "" if it doesn't exist. */
+
+static std::string
+file_identity (const char *path_)
+{
+  struct stat st;
+  if (0 != stat (path_, &st))
+    return std::string();
+  return form_string ("%lu:%lu:%lld:%lld",
+		      (unsigned long) st.st_dev,
+		      (unsigned long) st.st_ino,
+		      (long long) st.st_size,
+		      (long long) st.st_mtime);
+}  /* file_identity */
+
+/* The directory holding our cache files, which is created if needed,
+   or "" if there isn't one. */
+
+static std::string
+cache_dirname()
+{
+  std::string dir;
+  const char *xdg_cache_home = getenv ("XDG_CACHE_HOME");
+  const char *home = getenv ("HOME");
+  if (xdg_cache_home && '/' == xdg_cache_home[0])
+    dir = xdg_cache_home;
+  else if (home && '/' == home[0])
+    dir = std::string (home) + "/.cache";
+  else
+    return std::string();
+  if (0 != mkdir (dir.c_str(), 0700) && EEXIST != errno)
+    return std::string();
+  dir += "/mpirshim";
+  if (0 != mkdir (dir.c_str(), 0700) && EEXIST != errno)
+    return std::string();
+  return dir;
+}  /* cache_dirname */
+
+/* Fill in the cache filename_ for this executable, and the key_ a
+   valid entry in it starts with.  Return false if we can't cache. */
+
+static bool
+prefix_cache_key (const char *argv0_,
+		  std::string &filename_,
+		  std::string &key_)
+{
+  scoped_ptr<char> exe (realpath ("/proc/self/exe", 0));
+  if (!exe)
+    return false;
+  const std::string exe_identity = file_identity (exe.get());
+				/* What argv[0] is resolved against */
+  char cwd[PATH_MAX];
+  const char *context = ('/' == argv0_[0] ? ""
+			 : strchr (argv0_, '/') ? getcwd (cwd, sizeof (cwd))
+			 : getenv ("PATH"));
+  if (exe_identity.empty() || !context ||
+      strchr (argv0_, '\n') || strchr (context, '\n'))
+    return false;
+  const std::string dir = cache_dirname();
+  if (dir.empty())
+    return false;
+				/* FNV-1a hash of the executable's path */
+  unsigned long long hash = 14695981039346656037ULL;
+  for (const char *c = exe.get(); *c; c++)
+    hash = (hash ^ (unsigned char) *c) * 1099511628211ULL;
+  filename_ = form_string ("%s/pmix-prefix.%016llx", dir.c_str(), hash);
+  key_ = form_string ("%s\n%s\n%s\n%s\n",
+		      exe.get(), exe_identity.c_str(), argv0_, context);
+  return true;
+}  /* prefix_cache_key */
+
+/* Return the prefix in a valid entry in filename_, or "" if there is
+   no valid entry. */
+
+static std::string
+read_prefix_cache (const std::string &filename_, const std::string &key_)
+{
+  std::string entry;
+  FILE *file = fopen (filename_.c_str(), "r");
+  if (!file)
+    return entry;
+  char buffer[4096];
+  size_t count;
+  while (0 < (count = fread (buffer, 1, sizeof (buffer), file)))
+    entry.append (buffer, count);
+  fclose (file);
+				/* The key, then "PREFIX\nIDENTITY\n" */
+  if (0 != entry.compare (0, key_.size(), key_))
+    return std::string();
+  const std::string::size_type prefix_end = entry.find ('\n', key_.size());
+  if (std::string::npos == prefix_end)
+    return std::string();
+  const std::string prefix = entry.substr (key_.size(), prefix_end - key_.size());
+  const std::string identity = entry.substr (prefix_end + 1);
+  if (prefix.empty() ||
+      identity != file_identity (pmix_probe_path (prefix).c_str()) + "\n")
+    return std::string();
+  return prefix;
+}  /* read_prefix_cache */
+
+/* Replace the entry in filename_ with one for prefix_. */
+
+static void
+write_prefix_cache (const std::string &filename_,
+		    const std::string &key_,
+		    const std::string &prefix_)
+{
+  const std::string identity = file_identity (pmix_probe_path (prefix_).c_str());
+  if (identity.empty() || std::string::npos != prefix_.find ('\n'))
+    return;
+  const std::string entry = key_ + prefix_ + "\n" + identity + "\n";
+  std::string temp_filename = filename_ + ".XXXXXX";
+  int fd = mkstemp (&temp_filename[0]);
+  if (-1 == fd)
+    return;
+  const bool written = (ssize_t (entry.size()) ==
+			write (fd, entry.data(), entry.size()));
+  if (0 != close (fd) || !written ||
+      0 != rename (temp_filename.c_str(), filename_.c_str()))
+    {
+      debug_printf ("Could not write \"%s\"\n", filename_.c_str());
+      unlink (temp_filename.c_str());
+    }  /* if */
+}  /* write_prefix_cache */
+
+/**********************************************************************/
+/* Setup the pmix_prefix variable, which allows our PMIx to find its
+   shared libraries and files.  The basic idea here is that by looking
+   at argv[0] and possibly searching $PATH, we can sniff around for
+   where OpenPMIx is installed relatve to where this program is
+   installed. It's not a 100% reliable, but works for at least
+   TotalView.  */
+
+static void
+setup_pmix_prefix (const char *argv0_)
+{
+  NOTE_ENTRY_EXIT();
+
+				/* If argv[0] is null or empty, return */
+  if (0 == argv0_ || '\0' == argv0_[0])
+    return;
+				/* If "--pmix-prefix" was specified, return */
+  if (!pmix_prefix.empty())
+    return;
+
+  std::string cache_filename, cache_key;
+  const bool cacheable = (use_prefix_cache &&
+			  prefix_cache_key (argv0_, cache_filename, cache_key));
+  if (cacheable)
+    {
+      pmix_prefix = read_prefix_cache (cache_filename, cache_key);
+      if (!pmix_prefix.empty())
+	{
+	  debug_printf ("Setting pmix_prefix to \"%s\" from \"%s\"\n",
+			pmix_prefix.c_str(),
+			cache_filename.c_str());
+	  return;
 	}  /* if */
     }  /* if */
+
+  pmix_prefix = search_pmix_prefix (argv0_);
+  if (!pmix_prefix.empty())
+    {
+      debug_printf ("Setting pmix_prefix to \"%s\"\n", pmix_prefix.c_str());
+      if (cacheable)
+	write_prefix_cache (cache_filename, cache_key, pmix_prefix);
+    }  /* if */
 }  /* setup_pmix_prefix */
 
 /**********************************************************************/
@@ -1823,6 +6426,13 @@ setup_pmix_prefix (const char *argv0_)
 
 int mpir (int argc, char **argv)
 {
+  /*
+   * Remember the environment we started with, before PMIx adds to it.
+   */
+  for (char **envp = environ; *envp; envp++)
+    startup_environ.push_back (*envp);
+  std::sort (startup_environ.begin(), startup_environ.end());
+
   /*
    * Process any arguments we were given.
    */
@@ -1832,6 +6442,7 @@ int mpir (int argc, char **argv)
     pr_force_false,
     pr_force_true
   } proxy_run_pref = pr_unspecified;
+  bool discover = false;
   for (int i = 1; i < argc; i++)
     {
       if (argv[i][0] != '-')
@@ -1840,16 +6451,156 @@ int mpir (int argc, char **argv)
 	usage();		/* Print the usage message and exit */
       else if (!strcmp (argv[i], "-d") || !strcmp (argv[i], "--debug"))
 	debug_output = true;
+      else if (!strcmp (argv[i], "--timing"))
+	timing_output = true;
+      else if (const char *timeout = option_value ("--launch-timeout", i, argc, argv))
+	{
+	  char *end;
+	  const double secs = strtod (timeout, &end);
+	  if (end == timeout || '\0' != *end || secs < 0)
+	    usage (form_string ("Invalid SECS \"%s\" for option \"--launch-timeout\"",
+				timeout));
+	  for (int n = phase_connect; n < phase_running; n++)
+	    launch_phases[n].timeout = secs;
+	}  /* else-if */
+      else if (const char *grace = option_value ("--pmix-grace", i, argc, argv))
+	{
+	  char *end;
+	  pmix_grace = strtod (grace, &end);
+	  if (end == grace || '\0' != *end || pmix_grace < 0)
+	    usage (form_string ("Invalid SECS \"%s\" for option \"--pmix-grace\"",
+				grace));
+	}  /* else-if */
+      else if (const char *timeout = option_value ("--phase-timeout", i, argc, argv))
+	{
+	  const char *equals = strchr (timeout, '=');
+	  const std::string name (timeout, equals ? equals - timeout : strlen (timeout));
+	  int phase = phase_connect;
+	  while (phase < num_launch_phases && name != launch_phases[phase].name)
+	    phase++;
+	  char *end = 0;
+	  const double secs = (equals ? strtod (equals + 1, &end) : -1);
+	  if (num_launch_phases == phase || end == equals + 1 || '\0' != *end || secs < 0)
+	    usage (form_string ("Invalid PHASE=SECS \"%s\" for option \"--phase-timeout\"",
+				timeout));
+	  launch_phases[phase].timeout = secs;
+	}  /* else-if */
+      else if (const char *transfer = option_value ("--env-transfer", i, argc, argv))
+	{
+	  if (!strcmp (transfer, "full"))
+	    env_transfer = env_full;
+	  else if (!strcmp (transfer, "delta"))
+	    env_transfer = env_delta;
+	  else
+	    usage (form_string ("Invalid MODE \"%s\" for option \"--env-transfer\"",
+				transfer));
+	}  /* else-if */
+      else if (const char *allow = option_value ("--env-allow", i, argc, argv))
+	add_env_patterns (allow, env_allow);
+      else if (const char *deny = option_value ("--env-deny", i, argc, argv))
+	add_env_patterns (deny, env_deny);
+      else if (!strcmp (argv[i], "--background-cleanup"))
+	background_cleanup = true;
+      else if (!strcmp (argv[i], "--keep-dvm"))
+	keep_dvm_idle_timeout = 600;
+      else if (!strncmp (argv[i], "--keep-dvm=", 11))
+	{
+	  char *end;
+	  long n = strtol (argv[i] + 11, &end, 10);
+	  if (end == argv[i] + 11 || '\0' != *end || n < 1)
+	    usage (form_string ("Invalid SECS \"%s\" for option \"--keep-dvm\"",
+				argv[i] + 11));
+	  keep_dvm_idle_timeout = int (n);
+	}  /* else-if */
+      else if (!strcmp (argv[i], "--discover"))
+	discover = true;
+      else if (const char *uri = option_value ("--server-uri", i, argc, argv))
+	{
+	  server_uri = uri;
+	  discover = true;
+	}  /* else-if */
       else if (!strcmp (argv[i], "-p") || !strcmp (argv[i], "--force-proxy-run"))
 	proxy_run_pref = pr_force_true;
       else if (!strcmp (argv[i], "-n") || !strcmp (argv[i], "--force-no-proxy-run"))
 	proxy_run_pref = pr_force_false;
+      else if (!strcmp (argv[i], "--no-prefix-cache"))
+	use_prefix_cache = false;
       else if (!strcmp (argv[i], "--pmix-prefix"))
 	{
 	  if (i + 1 >= argc)
 	    usage (form_string ("PATH argument required for option \"%s\"", argv[i]));
 	  pmix_prefix = argv[++i];
 	}  /* else-if */
+      else if (!strcmp (argv[i], "--proctable-threads"))
+	{
+	  if (i + 1 >= argc)
+	    usage (form_string ("N argument required for option \"%s\"", argv[i]));
+	  char *end;
+	  long n = strtol (argv[++i], &end, 10);
+	  if (end == argv[i] || '\0' != *end || n < 1 || n > 4096)
+	    usage (form_string ("Invalid thread count \"%s\" for option \"%s\"",
+				argv[i], argv[i - 1]));
+	  proctable_threads = int (n);
+	}  /* else-if */
+      else if (const char *layout = option_value ("--proctable-layout", i, argc, argv))
+	{
+	  if (!strcmp (layout, "heap"))
+	    proctable_layout = layout_heap;
+	  else if (!strcmp (layout, "packed"))
+	    proctable_layout = layout_packed;
+	  else if (!strcmp (layout, "huge"))
+	    proctable_layout = layout_huge;
+	  else
+	    usage (form_string ("Invalid LAYOUT \"%s\" for option \"--proctable-layout\"",
+				layout));
+	}  /* else-if */
+      else if (const char *ranks = option_value ("--attach-ranks", i, argc, argv))
+	{
+	  if (!attach_selector.add_ranks (ranks))
+	    usage (form_string ("Invalid LIST \"%s\" for option \"--attach-ranks\"",
+				ranks));
+	}  /* else-if */
+      else if (const char *hosts = option_value ("--attach-hosts", i, argc, argv))
+	attach_selector.add_hosts (hosts);
+      else if (!strcmp (argv[i], "--skip-if-not-debugged"))
+	skip_if_not_debugged = true;
+      else if (!strcmp (argv[i], "--debug-gate"))
+	use_debug_gate = true;
+      else if (!strcmp (argv[i], "--follow-spawns"))
+	follow_spawns = true;
+      else if (!strcmp (argv[i], "--proctable-stream"))
+	proctable_stream_batch = 64;
+      else if (!strncmp (argv[i], "--proctable-stream=", 19))
+	{
+	  char *end;
+	  long n = strtol (argv[i] + 19, &end, 10);
+	  if (end == argv[i] + 19 || '\0' != *end || n < 1)
+	    usage (form_string ("Invalid BATCH \"%s\" for option \"--proctable-stream\"",
+				argv[i] + 19));
+	  proctable_stream_batch = size_t (n);
+	}  /* else-if */
+      else if (const char *order = option_value ("--proctable-order", i, argc, argv))
+	{
+	  if (!strcmp (order, "rank"))
+	    proctable_order = order_rank;
+	  else if (!strcmp (order, "host"))
+	    proctable_order = order_host;
+	  else if (!strcmp (order, "pmix"))
+	    proctable_order = order_pmix;
+	  else
+	    usage (form_string ("Invalid ORDER \"%s\" for option \"--proctable-order\"",
+				order));
+	}  /* else-if */
+      else if (const char *query = option_value ("--proctable-query", i, argc, argv))
+	{
+	  if (!strcmp (query, "global"))
+	    proctable_query_per_node = false;
+	  else if (!strcmp (query, "per-node"))
+	    proctable_query_per_node = true;
+	  else
+	    usage (form_string ("Invalid QUERY \"%s\" for option \"--proctable-query\"",
+				query));
+	}  /* else-if */
       argi = i + 1;
     }  /* for */
   if (argi >= argc)		/* No program arguments? */
@@ -1866,6 +6617,55 @@ int mpir (int argc, char **argv)
   launcher_base = (launcher_base
 		   ? launcher_base + 1
 		   : launcher_name);
+
+  /*
+   * With "--keep-dvm", launch with prun in the kept DVM, as a non-proxy
+   * run.  Pass prun the DVM's URI, and keep the rest of the launcher
+   * arguments.  That only works if they are PRRTE options to begin
+   * with, so other launchers (mpirun, srun, ...) are a usage error.
+   */
+  kept_dvm_t kept_dvm;
+  std::vector<char *> launcher_argv (&argv[argi], &argv[argc]);
+  std::string prun_path, dvm_uri_arg;
+  if (keep_dvm_idle_timeout > 0 && pr_force_true != proxy_run_pref)
+    {
+      if (strcmp (launcher_base, "prun") && strcmp (launcher_base, "prterun"))
+	usage (form_string ("Option \"--keep-dvm\" requires launcher prun or "
+			    "prterun, not \"%s\"", launcher_base));
+      scoped_phase_t phase ("kept DVM");
+      const std::string uri = setup_kept_dvm (kept_dvm, launcher_name);
+      if (!uri.empty())
+	{
+	  server_uri = uri;
+	  proxy_run_pref = pr_force_false;
+	  discover = false;
+	  if (strcmp (launcher_base, "prun"))
+	    {
+	      debug_printf ("Using prun instead of '%s' in the kept DVM\n",
+			    launcher_base);
+	      prun_path = kept_dvm.program ("prun");
+	      launcher_argv[0] = (char *) prun_path.c_str();
+	      launcher_base = "prun";
+	    }  /* if */
+	  dvm_uri_arg = "file:" + kept_dvm.uri_file;
+	  launcher_argv.insert (launcher_argv.begin() + 1, (char *) "--dvm-uri");
+	  launcher_argv.insert (launcher_argv.begin() + 2, (char *) dvm_uri_arg.c_str());
+	}  /* if */
+    }  /* if */
+
+  /*
+   * With "--discover" (or "--server-uri"), do a non-proxy run if a
+   * server is already running, and a proxy run only if there isn't.
+   */
+  if (discover && pr_force_true != proxy_run_pref)
+    {
+      const double discovery_timeout = 1;
+      scoped_phase_t phase ("server discovery");
+      server_uri = discover_server (discovery_timeout);
+      if (pr_unspecified == proxy_run_pref)
+	proxy_run_pref = (server_uri.empty() ? pr_force_true : pr_force_false);
+    }  /* if */
+
   const bool proxy_run = (proxy_run_pref == pr_unspecified
 			  ? strcmp (launcher_base, "prun") != 0
 			  : proxy_run_pref == pr_force_false
@@ -1881,20 +6681,49 @@ int mpir (int argc, char **argv)
    */
   setup_signal_handlers();
 
+  /*
+   * The launch is a pipeline, and steps that don't depend on each
+   * other run at the same time:
+   * - The session directory (only needed for a proxy run, by
+   *   spawn_launcher()) is created on another thread, while
+   * - pmix_prefix is set up and PMIx is initialized (which needs
+   *   pmix_prefix) on this thread.
+   * - The default event handler registration is started, but only
+   *   waited for along with the rest of the event handlers, so it
+   *   overlaps spawning the launcher and connecting to the server.
+   */
+  pthread_t session_thread;
+  if (proxy_run)
+    {
+      int err = pthread_create (&session_thread, 0, setup_session_paths_thread, 0);
+      if (0 != err)
+	fatal_error ("pthread_create() failed: %s",
+		     get_errno_string (err).c_str());
+    }  /* if */
+
   /*
    * Setup pmix_prefix before initializing PMIx.
    */
-  setup_pmix_prefix (argv[0]);
+  {
+    scoped_phase_t phase ("pmix prefix");
+    setup_pmix_prefix (argv[0]);
+    load_pmix_library();
+  }
 
   /*
    * Initialize ourselves as a PMIx tool.
    */
-  initialize_as_tool (proxy_run);
+  {
+    scoped_phase_t phase ("tool init");
+    initialize_as_tool (proxy_run);
+  }
 
   /*
-   * Register the default event handler.
+   * Start registering the default event handler.
    */
-  register_default_event_handler();
+  event_handler_batch_t registrations;
+  const double registrations_start = get_seconds();
+  register_default_event_handler (registrations);
 
   /*
    * The namespace of the launcher process.
@@ -1903,77 +6732,202 @@ int mpir (int argc, char **argv)
   /* initialize the nspace */
   PMIX_LOAD_NSPACE(launcher_nspace, NULL);
 
+  /*
+   * The launcher needs the session directory.
+   */
+  if (proxy_run)
+    {
+      void *result = 0;
+      pthread_join (session_thread, &result);
+      if (result)
+	{
+	  const std::string error = *(std::string *) result;
+	  delete (std::string *) result;
+	  fatal_error ("%s", error.c_str());
+	}  /* if */
+    }  /* if */
+
   /*
    * Spawn the launcher process.
    */
-  spawn_launcher (launcher_nspace, argc - argi, &argv[argi], proxy_run);
+  launch_state.older_children = get_child_pids();
+  {
+    scoped_phase_t phase ("spawn launcher");
+    spawn_launcher (launcher_nspace, launcher_argv.size(), &launcher_argv.front(), proxy_run);
+  }
+  launch_state.launcher_nspace = launcher_nspace;
+  if (proxy_run)
+    launch_state.launcher_pid = get_new_child (launch_state.older_children);
 
   /*
    * Connect to the server.
    */
   if (proxy_run)
-    connect_to_server();
+    {
+      scoped_phase_t phase ("connect to server");
+      launch_state.enter (phase_connect);
+      connect_to_server();
+    }  /* if */
 
   /*
-   * Register for the "launcher is ready to communicate" event.
+   * If there's no tool, there's nothing to do for one.  Only check if
+   * asked to, because a tool that attaches to us later can't set
+   * MPIR_being_debugged in time.
    */
-  release_t launcher_ready;
-  register_launcher_ready (&launcher_ready);
+  const bool debugging = (!skip_if_not_debugged || 0 != MPIR_being_debugged);
+  if (!debugging)
+    debug_printf ("MPIR_being_debugged is 0, skipping the debugger support\n");
 
   /*
-   * Register for the "launcher has completed launching" event.
+   * Register the rest of our event handlers at once, and wait for all
+   * of them together, along with the default event handler:
+   * - "launcher is ready to communicate",
+   * - "launcher has completed launching",
+   * - "launcher has terminated",
+   * - "job started", if we're following child jobs, and
+   * - "application process is ready for the debugger", if we're
+   *   streaming the proctable.
    */
+  release_t launcher_ready;
+  register_launcher_ready (registrations, &launcher_ready);
   release_t launcher_complete;
-  register_launcher_complete (&launcher_complete);
+  register_launcher_complete (registrations, &launcher_complete);
+  release_t launcher_terminate;
+  register_launcher_terminate (registrations, &launcher_terminate, launcher_nspace);
+
+  child_jobs_t children;
+  if (follow_spawns && debugging)
+    {
+      children.add_non_child (myproc.nspace);
+      children.add_non_child (launcher_nspace);
+      child_jobs = &children;
+      register_child_jobs (registrations, &children);
+    }  /* if */
+
+  stream_t stream;
+  if (proctable_stream_batch && debugging)
+    {
+      proctable_stream = &stream;
+      register_ready_for_debug (registrations, &stream);
+    }  /* if */
+
+  app_watch_t app_watch;
+  if (debugging)
+    {
+      launch_state.app_watch = &app_watch;
+      register_app_watch (registrations, &app_watch);
+    }  /* if */
+
+  launch_state.enter (phase_register);
+  if (const event_handler_batch_t::registration_t *failed =
+      registrations.wait (launch_state.get_deadline()))
+    {
+      if (PMIX_ERR_TIMEOUT == failed->status)
+	launch_state.stalled();
+      pmix_fatal_error (failed->status,
+			"Registering \"%s\" event handler: lock status",
+			failed->name.c_str());
+    }  /* if */
+  phase_times.record ("event handlers", registrations_start, get_seconds());
 
   /*
    * Wait here for the launcher to declare itself ready.
    */
   debug_printf ("Waiting for the launcher to be ready\n");
-  launcher_ready.lock.wait_thread();
+  {
+    scoped_phase_t phase ("wait for launcher ready");
+    launch_state.enter (phase_ready);
+    launch_state.wait (launcher_ready.latch);
+  }
   debug_printf ("Launcher is ready\n");
 
-  /*
-   * Register for the "launcher has terminated" event.
-   */
-  release_t launcher_terminate;
-  register_launcher_terminate (&launcher_terminate, launcher_nspace);
-
   /*
    * Send the launch directives.
    */
-  send_launch_directives (launcher_nspace);
-
-  /*
-   * Wait for the launcher to launch the job and get the namespace of
-   * the application.
-   */
-  debug_printf ("Waiting for the launcher's launch to complete\n");
-  launcher_complete.lock.wait_thread();
-  debug_printf ("Launcher's launch completed\n");
-
-  /*
-   * Get the application's namespace.
-   */
-  const char *app_nspace = launcher_complete.nspace;
+  send_launch_directives (launcher_nspace, debugging);
 
-  /*
-   * Extract the proctable and fill in the MPIR information.  If there
-   * is a debugger controlling us and it knows about MPIR, it will
-   * probably attach to the application processes.
-   */
-  pmix_proc_table_to_mpir (app_nspace);
+  if (debugging)
+    {
+      launch_state.enter (phase_launch);
+
+      /*
+       * If we're streaming, publish the proctable entries as the
+       * application processes report in, until the launch completes.
+       */
+      if (proctable_stream)
+	stream_proc_table_to_mpir (&stream);
+
+      /*
+       * Wait for the launcher to launch the job and get the namespace of
+       * the application.
+       */
+      debug_printf ("Waiting for the launcher's launch to complete\n");
+      {
+	scoped_phase_t phase ("wait for launch complete");
+	launch_state.wait (launcher_complete.latch);
+      }
+      debug_printf ("Launcher's launch completed\n");
+
+      /*
+       * Get the application's namespace.
+       */
+      const char *app_nspace = launcher_complete.nspace;
+      launch_state.app_nspace = app_nspace;
+      app_watch.set_app_nspace (app_nspace);
+      launch_state.set_launch_completed();
+      launch_state.enter (phase_proctable);
+
+      /*
+       * Give the application processes the grace period to show that
+       * they use PMIx, before the debugger attaches to them.
+       */
+      if (0 != pmix_grace)
+	{
+	  while (0 == app_watch.get_nready())
+	    {
+	      launch_state.check();
+	      usleep (10 * 1000);
+	    }  /* while */
+	}  /* if */
 
-  /*
-   * Release the launcher process and allow it to run.
-   */
-  release_launcher_process (app_nspace);
+      /*
+       * Extract the proctable and fill in the MPIR information.  If there
+       * is a debugger controlling us and it knows about MPIR, it will
+       * probably attach to the application processes.
+       */
+      if (!proctable_stream)
+	pmix_proc_table_to_mpir (app_nspace);
+      launch_state.enter (phase_running);
+
+      /*
+       * If the tool releases the processes one by one, wait for it to
+       * open their gates.
+       */
+      if (use_debug_gate)
+	release_debug_gates (&launcher_terminate);
+
+      /*
+       * Release the launcher process and allow it to run.
+       */
+      release_launcher_process (app_nspace);
+
+      /*
+       * Publish any child jobs until the launcher terminates.
+       */
+      if (child_jobs)
+	follow_child_jobs (child_jobs);
+    }  /* if */
 
   /*
    * Wait for the launcher to terminate.
    */
   debug_printf ("Waiting for the launcher to terminate\n");
-  launcher_terminate.lock.wait_thread();
+  {
+    scoped_phase_t phase ("wait for launcher exit");
+    launch_state.enter (phase_running);
+    launch_state.wait (launcher_terminate.latch);
+  }
+  phase_times.report();
   debug_printf ("Launcher has terminated: exit_code_give==%s, exit_code=%d\n",
 		launcher_terminate.exit_code_given ? "true" : "false",
 		launcher_terminate.exit_code);